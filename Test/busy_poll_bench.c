@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+#include <sys/stat.h>
+#include "const.h"
+
+/*
+ * A writer thread sends a message every PAUSE us, so the reader mostly finds the mailslot empty.
+ * The reader measures the latency from the enqueue timestamp (READ_EXT_CTL) to the return of the read,
+ * with the sleep path (busy-poll off) and with a busy-poll budget. Needs at least two CPUs: on a single one
+ * the module never spins.
+ */
+
+#define MESSAGES 20000
+#define PAUSE 20    // us
+
+int fd;
+
+unsigned long long monotonic_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void* writer(void* args) {
+    char msg[64];
+    unsigned long long deadline;
+    int i;
+
+    memset(msg, 'x', sizeof(msg));
+    for (i = 0; i < MESSAGES; i++) {
+        write(fd, msg, sizeof(msg));
+        deadline = monotonic_ns() + PAUSE * 1000ULL;
+        while (monotonic_ns() < deadline);
+    }
+    return NULL;
+}
+
+int compare(const void* a, const void* b) {
+    unsigned long long x = *(unsigned long long*)a, y = *(unsigned long long*)b;
+    return (x > y) - (x < y);
+}
+
+void run(int budget) {
+    static unsigned long long latency[MESSAGES];
+    char buf[MAX_SEGMENT_SIZE];
+    read_ext ext;
+    pthread_t tid;
+    int i;
+
+    ioctl(fd, CHANGE_BUSY_POLL_CTL, budget);
+    pthread_create(&tid, NULL, writer, NULL);
+
+    ext.buf = buf;
+    for (i = 0; i < MESSAGES; i++) {
+        ext.len = MAX_SEGMENT_SIZE;
+        ioctl(fd, READ_EXT_CTL, &ext);
+        latency[i] = monotonic_ns() - ext.enqueue_time;
+    }
+    pthread_join(tid, NULL);
+
+    qsort(latency, MESSAGES, sizeof(unsigned long long), compare);
+    printf("busy-poll %5d us: p50 %8llu ns, p99 %8llu ns, p999 %8llu ns\n", budget,
+            latency[MESSAGES / 2], latency[MESSAGES * 99 / 100], latency[MESSAGES * 999 / 1000]);
+}
+
+int main(int argc, char** argv) {
+    char read_buf[MAX_SEGMENT_SIZE];
+
+
+	if(argc != 3){
+		printf("You should pass MAJOR number and MINOR number as parameters\n");
+		return -1;
+	}
+
+	int major = atoi(argv[1]);
+	int minor = atoi(argv[2]);
+	dev_t device = makedev(major, minor);
+
+    char pathname[80];
+    sprintf(pathname,"/dev/mailslot%d", minor);
+
+	if( mknod(pathname, S_IFCHR|0666, device) == -1 ){
+		if(errno == EEXIST)
+			printf("Pathname '%s' already exists\n",pathname);
+
+        else {
+			printf("ERROR in the creation of the file %s: %s\n", pathname, strerror(errno));
+			return -1;
+        }
+    }
+
+	fd = open(pathname, 0666);
+
+	if(fd == -1) {
+		printf("ERROR while opening the file %s: %s\n", pathname, strerror(errno));
+		return -1;
+    }
+
+    while(ioctl(fd, GET_FREESPACE_SIZE_CTL) < MAX_MAIL_SLOT_SIZE)
+       read(fd, read_buf, MAX_SEGMENT_SIZE);
+
+    // TEST 1
+    printf("TEST 1: budget above the limit refused - ");
+    if (ioctl(fd, CHANGE_BUSY_POLL_CTL, MAX_BUSY_POLL + 1) == -1 && errno == EINVAL)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 2
+    ioctl(fd, CHANGE_BUSY_POLL_CTL, 50);
+    printf("TEST 2: budget changed - ");
+    if (ioctl(fd, GET_BUSY_POLL_CTL) == 50)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    run(0);
+    run(50);
+    run(200);
+
+    ioctl(fd, CHANGE_BUSY_POLL_CTL, 0);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,177 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+#include <sys/stat.h>
+#include "const.h"
+
+#define CALLS 100
+
+int req_fd, reply_fd;
+int short_reply_errno;
+
+
+int open_mailslot(int major, int minor) {
+    char pathname[80];
+    dev_t device = makedev(major, minor);
+
+    sprintf(pathname,"/dev/mailslot%d", minor);
+
+	if( mknod(pathname, S_IFCHR|0666, device) == -1 ){
+		if(errno == EEXIST)
+			printf("Pathname '%s' already exists\n",pathname);
+
+        else {
+			printf("ERROR in the creation of the file %s: %s\n", pathname, strerror(errno));
+			return -1;
+        }
+    }
+
+	int fd = open(pathname, 0666);
+
+	if(fd == -1)
+		printf("ERROR while opening the file %s: %s\n", pathname, strerror(errno));
+    return fd;
+}
+
+// answers every request with its echo, the last one first with a reply too large for the caller
+void* responder(void* args) {
+    char buf[MAX_SEGMENT_SIZE];
+    read_ext ext = {buf, MAX_SEGMENT_SIZE};
+    call_reply reply;
+    int i, len;
+
+    for (i = 0; i <= CALLS; i++) {
+        len = ioctl(req_fd, READ_EXT_CTL, &ext);
+        if (len < 0)
+            continue;
+
+        reply.call_id = ext.call_id;
+        reply.buf = buf;
+        if (i == CALLS) {
+            reply.len = MAX_SEGMENT_SIZE;
+            if (ioctl(reply_fd, REPLY_CTL, &reply) == -1)
+                short_reply_errno = errno;
+        }
+        reply.len = len;
+        ioctl(reply_fd, REPLY_CTL, &reply);
+    }
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+    char req[64], out[MAX_SEGMENT_SIZE], pathname[80];
+    call_request call;
+    call_reply reply;
+    read_ext ext;
+    pthread_t tid;
+    int i, ret, rdonly, matched = 0, distinct = 1;
+    unsigned long long last_id = 0;
+
+
+	if(argc != 3){
+		printf("You should pass MAJOR number and MINOR number as parameters (requests on MINOR, replies on MINOR+1)\n");
+		return -1;
+	}
+
+	int major = atoi(argv[1]);
+	int minor = atoi(argv[2]);
+
+    req_fd = open_mailslot(major, minor);
+    reply_fd = open_mailslot(major, minor + 1);
+    if (req_fd == -1 || reply_fd == -1)
+        return -1;
+
+    while(ioctl(req_fd, GET_FREESPACE_SIZE_CTL) < MAX_MAIL_SLOT_SIZE)
+       read(req_fd, out, MAX_SEGMENT_SIZE);
+
+    // TEST 1
+    ext.buf = out;
+    ext.len = sizeof(out);
+    write(req_fd, "plain", 5);
+    printf("TEST 1: plain message has no correlation id - ");
+    if (ioctl(req_fd, READ_EXT_CTL, &ext) == 5 && ext.call_id == 0)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 2
+    reply.call_id = 12345;
+    reply.buf = out;
+    reply.len = 5;
+    printf("TEST 2: reply nobody is waiting for refused - ");
+    if (ioctl(reply_fd, REPLY_CTL, &reply) == -1 && errno == ENOENT)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    pthread_create(&tid, NULL, responder, NULL);
+
+    /* CALLS, EACH ONE ANSWERED WITH THE ECHO OF ITS REQUEST */
+    for (i = 0; i < CALLS; i++) {
+        sprintf(req, "request %d", i);
+        memset(out, 0, sizeof(out));
+        call.req = req;
+        call.req_len = strlen(req) + 1;
+        call.reply = out;
+        call.reply_len = sizeof(out);
+        call.reply_minor = minor + 1;
+
+        ret = ioctl(req_fd, CALL_CTL, &call);
+        if (ret == call.req_len && strcmp(req, out) == 0)
+            matched++;
+        if (call.call_id <= last_id)
+            distinct = 0;
+        last_id = call.call_id;
+    }
+
+    // TEST 3
+    printf("TEST 3: every call gets its own reply - ");
+    if (matched == CALLS)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED (%d of %d)\n", matched, CALLS);
+
+    // TEST 4
+    printf("TEST 4: correlation ids increasing - ");
+    if (distinct)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 5
+    call.req = "short";
+    call.req_len = 5;
+    call.reply = out;
+    call.reply_len = 5;
+    ret = ioctl(req_fd, CALL_CTL, &call);
+    pthread_join(tid, NULL);
+    printf("TEST 5: reply larger than the caller buffer refused, caller still answered - ");
+    if (short_reply_errno == EMSGSIZE && ret == 5 && memcmp(out, "short", 5) == 0)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 6
+    sprintf(pathname,"/dev/mailslot%d", minor);
+    rdonly = open(pathname, O_RDONLY);
+    call.req = "denied";
+    call.req_len = 6;
+    reply.call_id = 1;
+    printf("TEST 6: call and reply on files open read-only refused - ");
+    if (ioctl(rdonly, CALL_CTL, &call) == -1 && errno == EBADF && ioctl(rdonly, REPLY_CTL, &reply) == -1 &&
+            errno == EBADF && ioctl(req_fd, GET_FREESPACE_SIZE_CTL) == MAX_MAIL_SLOT_SIZE)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+    close(rdonly);
+
+    close(req_fd);
+    close(reply_fd);
+    return 0;
+}
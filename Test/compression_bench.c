@@ -0,0 +1,117 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+#include <sys/stat.h>
+#include "const.h"
+
+/*
+ * Fills the mailslot with non-blocking writes of MAX_SEGMENT_SIZE messages until it is full,
+ * then drains it, with compression off and on, for compressible (JSON-like) and
+ * incompressible (random) payloads. Reports capacity in messages and write/read throughput.
+ */
+
+
+double elapsed(struct timespec* start, struct timespec* end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void fill_json(char* msg) {
+    int off = 0, i = 0;
+    while (off < MAX_SEGMENT_SIZE - 64) {
+        off += sprintf(msg + off, "{\"sensor\":\"temp\",\"id\":%d,\"value\":%d,\"unit\":\"C\"},", i % 16, 20 + i % 5);
+        i++;
+    }
+    memset(msg + off, ' ', MAX_SEGMENT_SIZE - off);
+}
+
+void fill_random(char* msg) {
+    int i;
+    for (i = 0; i < MAX_SEGMENT_SIZE; i++)
+        msg[i] = rand();
+}
+
+void run(int fd, const char* name, char* msg, int mode) {
+    char read_buf[MAX_SEGMENT_SIZE];
+    struct timespec start, end;
+    long count = 0, i;
+    double write_time, read_time;
+
+    ioctl(fd, CHANGE_COMPRESSION_MODE_CTL, mode);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (write(fd, msg, MAX_SEGMENT_SIZE) > 0)
+        count++;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    write_time = elapsed(&start, &end);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < count; i++)
+        read(fd, read_buf, MAX_SEGMENT_SIZE);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    read_time = elapsed(&start, &end);
+
+    printf("%-14s compression %-3s: capacity %6ld msgs (%5.2fx), write %8.1f MB/s, read %8.1f MB/s\n",
+            name, mode == COMPRESSION_ON ? "on" : "off", count, (double)count * MAX_SEGMENT_SIZE / MAX_MAIL_SLOT_SIZE,
+            count * (double)MAX_SEGMENT_SIZE / write_time / (1 << 20), count * (double)MAX_SEGMENT_SIZE / read_time / (1 << 20));
+}
+
+
+int main(int argc, char** argv) {
+    char read_buf[MAX_SEGMENT_SIZE];
+    char msg[MAX_SEGMENT_SIZE];
+
+
+	if(argc != 3){
+		printf("You should pass MAJOR number and MINOR number as parameters\n");
+		return -1;
+	}
+
+	int major = atoi(argv[1]);
+	int minor = atoi(argv[2]);
+	dev_t device = makedev(major, minor);
+
+    char pathname[80];
+    sprintf(pathname,"/dev/mailslot%d", minor);
+
+	if( mknod(pathname, S_IFCHR|0666, device) == -1 ){
+		if(errno == EEXIST)
+			printf("Pathname '%s' already exists\n",pathname);
+
+        else {
+			printf("ERROR in the creation of the file %s: %s\n", pathname, strerror(errno));
+			return -1;
+        }
+    }
+
+	int fd = open(pathname, 0666);
+
+	if(fd == -1) {
+		printf("ERROR while opening the file %s: %s\n", pathname, strerror(errno));
+		return -1;
+    }
+
+    while(ioctl(fd, GET_FREESPACE_SIZE_CTL) < MAX_MAIL_SLOT_SIZE)
+       read(fd, read_buf, MAX_SEGMENT_SIZE);
+
+    ioctl(fd, CHANGE_WRITE_BLOCKING_MODE_CTL, NON_BLOCKING_MODE);
+
+    fill_json(msg);
+    run(fd, "compressible", msg, COMPRESSION_OFF);
+    run(fd, "compressible", msg, COMPRESSION_ON);
+
+    fill_random(msg);
+    run(fd, "incompressible", msg, COMPRESSION_OFF);
+    run(fd, "incompressible", msg, COMPRESSION_ON);
+
+    ioctl(fd, CHANGE_COMPRESSION_MODE_CTL, COMPRESSION_OFF);
+    ioctl(fd, CHANGE_WRITE_BLOCKING_MODE_CTL, BLOCKING_MODE);
+
+    close(fd);
+    return 0;
+}
@@ -1,5 +1,6 @@
 #define MAX_SEGMENT_SIZE (1<<10)
 #define MAX_MAIL_SLOT_SIZE (1<<20)
+#define MAX_MAIL_SLOT_MEMORY (2*MAX_MAIL_SLOT_SIZE)
 
 #define BLOCKING_MODE 0
 #define NON_BLOCKING_MODE 1
@@ -13,3 +14,161 @@
 #define GET_FREESPACE_SIZE_CTL 7
 #define GET_WRITE_BLOCKING_MODE_CTL 8
 #define GET_READ_BLOCKING_MODE_CTL 9
+
+// latency histograms
+#define GET_LATENCY_STATS_CTL 10
+#define RESET_LATENCY_STATS_CTL 11
+
+#define LAT_HIST_BUCKETS 32
+
+typedef struct lat_hist{
+    unsigned long long bucket[LAT_HIST_BUCKETS];
+} lat_hist;
+
+typedef struct latency_stats{
+    lat_hist read_lock_wait;
+    lat_hist read_lock_hold;
+    lat_hist write_lock_wait;
+    lat_hist write_lock_hold;
+    lat_hist read_blocked;
+    lat_hist write_blocked;
+    lat_hist residency;
+} latency_stats;
+
+// readiness notification
+#define BIND_EVENTFD_CTL 12
+
+#define NOTIFY_NON_EMPTY 0x1
+#define NOTIFY_DEPTH 0x2
+#define NOTIFY_SPACE 0x4
+
+typedef struct eventfd_binding{
+    int fd;
+    int events;
+    int depth;
+} eventfd_binding;
+
+// compression
+#define CHANGE_COMPRESSION_MODE_CTL 13
+#define GET_COMPRESSION_MODE_CTL 14
+
+#define COMPRESSION_OFF 0
+#define COMPRESSION_ON 1
+
+// status page
+#define GET_USED_MEMORY_CTL 15
+
+typedef struct mailslot_status{
+    unsigned int seq;
+    int used_space;
+    int used_memory;
+    int msg_count;
+    int max_size;
+    int max_memory;
+    int max_segment_size;
+    unsigned long long enqueued;
+    unsigned long long dequeued;
+    unsigned long long expired;
+} mailslot_status;
+
+// extended read
+#define READ_EXT_CTL 16
+
+typedef struct read_ext{
+    char* buf;
+    int len;
+    unsigned long long seq;
+    unsigned long long enqueue_time;
+    unsigned long long dequeue_time;
+    unsigned long long call_id;
+} read_ext;
+
+// message expiry
+#define CHANGE_TTL_CTL 17
+#define GET_TTL_CTL 18
+#define GET_EXPIRED_COUNT_CTL 19
+
+// busy polling
+#define CHANGE_BUSY_POLL_CTL 20
+#define GET_BUSY_POLL_CTL 21
+
+#define MAX_BUSY_POLL 10000
+
+// partitioned consumption
+#define CHANGE_PARTITION_MODE_CTL 22
+#define GET_PARTITION_MODE_CTL 23
+#define SET_PARTITION_KEY_CTL 24
+#define GET_PARTITION_COUNT_CTL 25
+
+#define PARTITION_OFF 0
+#define PARTITION_ON 1
+#define NUM_PARTITIONS 32
+
+// large messages
+#define MAX_MESSAGE_SIZE MAX_MAIL_SLOT_SIZE
+
+// request/reply calls
+#define CALL_CTL 26
+#define REPLY_CTL 27
+
+typedef struct call_request{
+    char* req;
+    int req_len;
+    char* reply;
+    int reply_len;
+    int reply_minor;
+    unsigned long long call_id;
+} call_request;
+
+typedef struct call_reply{
+    unsigned long long call_id;
+    char* buf;
+    int len;
+} call_reply;
+
+// cache-aware wakeup
+#define CHANGE_WAKEUP_POLICY_CTL 28
+#define GET_WAKEUP_POLICY_CTL 29
+#define SET_READER_CPU_CTL 30
+
+#define WAKEUP_FIFO 0
+#define WAKEUP_CACHE 1
+
+// corked writes
+#define CORK_CTL 31
+#define GET_CORK_CTL 32
+#define CHANGE_CORK_DELAY_CTL 33
+#define GET_CORK_DELAY_CTL 34
+
+#define PACKED_MAX_SIZE 256
+
+#define CORK_OFF 0
+#define CORK_ON 1
+#define CORK_DELAY 1000
+#define MAX_CORK_DELAY 1000000
+
+// multicast
+#define MULTICAST_CTL 35
+
+#define MAX_MULTICAST 16
+
+typedef struct multicast{
+    char* buf;
+    int len;
+    int nr_fds;
+    int fds[MAX_MULTICAST];
+    int results[MAX_MULTICAST];
+} multicast;
+
+// segment pools
+#define GET_POOL_STATS_CTL 36
+
+#define POOL_MAX 256
+
+typedef struct pool_stats{
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long trimmed;
+    int segments;
+    int pages;
+} pool_stats;
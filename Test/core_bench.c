@@ -0,0 +1,179 @@
+#include "../mailslot_core.c"
+
+/*
+ * Throughput microbenchmark of the mailslot core built in user space (see ushim.h), no module needed.
+ * Producers and consumers move fixed-size messages through one mailslot with the same allocation and
+ * copy pattern as write() and read(); the latency histograms of the core are printed at the end.
+ * Profile the queue with perf:
+ *     perf record -g ./core_bench [producers] [consumers] [message size] [messages per producer]
+ *                                 [busy-poll budget us] [producer pause us]
+ * With a producer pause the mailslot is mostly empty and the residency histogram shows the cost of waking up
+ * a reader, to compare the sleep path with busy-polling.
+ */
+
+#define MINOR 0
+
+int producers = 1, consumers = 1, msg_size = 64, messages = 1000000, poll_us = 0, pause_us = 0;
+atomic_t remaining;
+
+
+int enqueue(char* data, int len) {
+    segment small_msg;
+    segment* new_msg;
+    int res;
+
+    if (len <= PACKED_MAX_SIZE) {
+        new_msg = &small_msg;
+        memset(new_msg, 0, sizeof(segment));
+        new_msg->payload = data;
+    }
+    else {
+        new_msg = alloc_segment(&pools[MINOR], len, GFP_KERNEL);
+        copy_to_segment(new_msg, data, len);
+    }
+    new_msg->size = len;
+    new_msg->orig_size = len;
+
+    res = enqueue_segment(MINOR, new_msg, len, BLOCKING_MODE);
+    if (res < 0 && new_msg != &small_msg)
+        free_segment(new_msg);
+    return res;
+}
+
+// busy wait, a sleep would be much longer than the pause
+void pause_for(unsigned long long ns) {
+    unsigned long long deadline = now_ns() + ns;
+
+    while (now_ns() < deadline)
+        cpu_relax();
+}
+
+void* producer(void* args) {
+    char data[MAX_SEGMENT_SIZE];
+    int i;
+
+    memset(data, 'x', msg_size);
+    for (i = 0; i < messages; i++) {
+        enqueue(data, msg_size);
+        if (pause_us > 0)
+            pause_for(pause_us * 1000ULL);
+    }
+    return NULL;
+}
+
+// consumers claim a message before reading it, so that none of them blocks forever at the end
+int claim(void) {
+    int old;
+
+    do {
+        old = atomic_read(&remaining);
+        if (old == 0)
+            return 0;
+    } while (atomic_cmpxchg(&remaining, old, old - 1) != old);
+
+    return 1;
+}
+
+void* consumer(void* args) {
+    char buffer[MAX_SEGMENT_SIZE];
+    message msg;
+    int res;
+
+    while (claim()) {
+        res = dequeue_segment(MINOR, NULL, MAX_SEGMENT_SIZE, BLOCKING_MODE, &msg);
+        if (res < 0)
+            continue;
+        memcpy(buffer, message_data(&msg), res);
+        release_message(&msg);
+    }
+    return NULL;
+}
+
+void print_hist(char* name, lat_hist* hist) {
+    int i, last = -1;
+    unsigned long long total = 0, partial = 0;
+    int p50 = -1, p99 = -1, p999 = -1;
+
+    for (i = 0; i < LAT_HIST_BUCKETS; i++) {
+        total += hist->bucket[i];
+        if (hist->bucket[i])
+            last = i;
+    }
+    if (total == 0) {
+        printf("%-16s no samples\n", name);
+        return;
+    }
+
+    for (i = 0; i < LAT_HIST_BUCKETS; i++) {
+        partial += hist->bucket[i];
+        if (p50 < 0 && partial * 2 >= total)
+            p50 = i;
+        if (p99 < 0 && partial * 100 >= total * 99)
+            p99 = i;
+        if (p999 < 0 && partial * 1000 >= total * 999)
+            p999 = i;
+    }
+
+    // bucket i holds values in [2^(i-1), 2^i) ns
+    printf("%-16s samples %llu  p50 < %llu ns  p99 < %llu ns  p999 < %llu ns  max < %llu ns\n", name, total,
+            1ULL << p50, 1ULL << p99, 1ULL << p999, 1ULL << last);
+}
+
+
+int main(int argc, char** argv) {
+    int i;
+    pthread_t* threads;
+    unsigned long long start, elapsed;
+    double total;
+
+    if (argc > 1)
+        producers = atoi(argv[1]);
+    if (argc > 2)
+        consumers = atoi(argv[2]);
+    if (argc > 3)
+        msg_size = atoi(argv[3]);
+    if (argc > 4)
+        messages = atoi(argv[4]);
+    if (argc > 5)
+        poll_us = atoi(argv[5]);
+    if (argc > 6)
+        pause_us = atoi(argv[6]);
+
+    if (msg_size <= 0 || msg_size > MAX_SEGMENT_SIZE) {
+        printf("message size must be in 1..%d\n", MAX_SEGMENT_SIZE);
+        return 1;
+    }
+
+    init_mailslot(MINOR);
+    busy_poll[MINOR] = poll_us * 1000ULL;
+    atomic_set(&remaining, producers * messages);
+    threads = malloc((producers + consumers) * sizeof(pthread_t));
+
+    start = now_ns();
+    for (i = 0; i < consumers; i++)
+        pthread_create(&threads[producers + i], NULL, consumer, NULL);
+    for (i = 0; i < producers; i++)
+        pthread_create(&threads[i], NULL, producer, NULL);
+    for (i = 0; i < producers + consumers; i++)
+        pthread_join(threads[i], NULL);
+    elapsed = now_ns() - start;
+
+    total = (double)producers * messages;
+    printf("%d producers, %d consumers, %d bytes x %d messages each, busy-poll %d us, pause %d us\n",
+            producers, consumers, msg_size, messages, poll_us, pause_us);
+    printf("elapsed %.3f s, %.0f msg/s, %.1f MB/s\n", elapsed / 1e9, total / (elapsed / 1e9),
+            total * msg_size / (elapsed / 1e3));
+
+    print_hist("read lock wait", &latency[MINOR].read_lock_wait);
+    print_hist("read lock hold", &latency[MINOR].read_lock_hold);
+    print_hist("read blocked", &latency[MINOR].read_blocked);
+    print_hist("write lock wait", &latency[MINOR].write_lock_wait);
+    print_hist("write lock hold", &latency[MINOR].write_lock_hold);
+    print_hist("write blocked", &latency[MINOR].write_blocked);
+    print_hist("residency", &latency[MINOR].residency);
+
+    cleanup_mailslot(MINOR);
+    pool_trim(&pools[MINOR], ULONG_MAX);
+    free(threads);
+    return 0;
+}
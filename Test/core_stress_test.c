@@ -0,0 +1,960 @@
+#include "../mailslot_core.c"
+
+/*
+ * Stress test of the mailslot core built in user space (see ushim.h), no module needed.
+ * Producers enqueue messages of random size (packed and single segments) tagged with
+ * producer id and sequence number, some of them in non-blocking mode; consumers check
+ * per-producer FIFO order and payload integrity. At the end the accounting must be back to zero.
+ * Run it under valgrind --tool=helgrind or memcheck to check the core:
+ *     ./core_stress_test [producers] [consumers] [messages per producer]
+ */
+
+#define MINOR 0
+#define POISON (-1)
+
+typedef struct header{
+    int producer;
+    int seq;
+} header;
+
+int producers = 4, consumers = 4, messages = 100000;
+atomic_t consumed;
+atomic_t errors;
+
+
+// same allocation choices as mailslot_write(): small messages are on the stack and get packed
+int enqueue_keyed(char* data, int len, int blk_mode, unsigned int key) {
+    segment small_msg;
+    segment* new_msg;
+    int res;
+
+    if (len <= PACKED_MAX_SIZE) {
+        new_msg = &small_msg;
+        memset(new_msg, 0, sizeof(segment));
+        new_msg->payload = data;
+    }
+    else {
+        new_msg = alloc_segment(&pools[MINOR], len, GFP_KERNEL);
+        copy_to_segment(new_msg, data, len);
+    }
+    new_msg->size = len;
+    new_msg->orig_size = len;
+    new_msg->meta.key = key;
+
+    res = enqueue_segment(MINOR, new_msg, len, blk_mode);
+    if (res < 0 && new_msg != &small_msg)
+        free_segment(new_msg);
+    return res;
+}
+
+int enqueue(char* data, int len, int blk_mode) {
+    return enqueue_keyed(data, len, blk_mode, 0);
+}
+
+void* producer(void* args) {
+    int id = (int)(long)args;
+    unsigned int seed = id;
+    char data[MAX_SEGMENT_SIZE];
+    header* h = (header*)data;
+    int i, len, blk_mode = (id % 2) ? NON_BLOCKING_MODE : BLOCKING_MODE;
+
+    for (i = 0; i < messages; i++) {
+        len = sizeof(header) + rand_r(&seed) % (MAX_SEGMENT_SIZE - sizeof(header) + 1);
+        h->producer = id;
+        h->seq = i;
+        memset(data + sizeof(header), (char)(id + i), len - sizeof(header));
+
+        // non-blocking producers retry, as a user space program would
+        while (enqueue(data, len, blk_mode) < 0)
+            sched_yield();
+    }
+    return NULL;
+}
+
+void* consumer(void* args) {
+    int* last_seq = malloc(producers * sizeof(int));
+    long long last_meta_seq = -1;
+    message msg;
+    char* data;
+    header* h;
+    int i, res;
+
+    for (i = 0; i < producers; i++)
+        last_seq[i] = -1;
+
+    while (1) {
+        res = dequeue_segment(MINOR, NULL, MAX_SEGMENT_SIZE, BLOCKING_MODE, &msg);
+        if (res < 0) {
+            atomic_add(1, &errors);
+            continue;
+        }
+
+        data = message_data(&msg);
+        h = (header*)data;
+        if (h->producer == POISON) {
+            release_message(&msg);
+            break;
+        }
+
+        if (h->seq <= last_seq[h->producer])
+            atomic_add(1, &errors);
+        last_seq[h->producer] = h->seq;
+
+        // sequence numbers stamped at enqueue follow the mailslot order
+        if ((long long)msg.meta.seq <= last_meta_seq)
+            atomic_add(1, &errors);
+        last_meta_seq = msg.meta.seq;
+
+        for (i = sizeof(header); i < res; i++)
+            if (data[i] != (char)(h->producer + h->seq)) {
+                atomic_add(1, &errors);
+                break;
+            }
+
+        release_message(&msg);
+        atomic_add(1, &consumed);
+    }
+
+    free(last_seq);
+    return NULL;
+}
+
+
+// fairness scenario: a large writer queued behind a full mailslot must not be overtaken by small ones
+#define FILLER 1000
+#define LARGE 1001
+#define SMALL 1002
+
+int waiting_writers(void) {
+    int n = 0;
+    elem* aux;
+
+    mutex_lock(&tail_mutex[MINOR]);
+    for (aux = writers_list[MINOR].head.next; aux != &(writers_list[MINOR].tail); aux = aux->next)
+        n++;
+    mutex_unlock(&tail_mutex[MINOR]);
+    return n;
+}
+
+void* tagged_writer(void* args) {
+    char data[MAX_SEGMENT_SIZE];
+    header* h = (header*)data;
+    int i, tag = (int)(long)args;
+
+    memset(data, 0, MAX_SEGMENT_SIZE);
+    h->producer = tag;
+    for (i = 0; i < (tag == LARGE ? 1 : 64); i++) {
+        h->seq = i;
+        enqueue(data, tag == LARGE ? MAX_SEGMENT_SIZE : 16, BLOCKING_MODE);
+    }
+    return NULL;
+}
+
+// returns 1 if the large message has been read before every message of the small writer
+int fairness_test(void) {
+    char data[MAX_SEGMENT_SIZE];
+    header* h = (header*)data;
+    pthread_t large, small;
+    message msg;
+    int large_pos = -1, small_pos = -1, pos = 0;
+
+    // packed fillers, then single segments for the memory a new chunk would not fit in
+    memset(data, 0, sizeof(data));
+    h->producer = FILLER;
+    while (enqueue(data, 16, NON_BLOCKING_MODE) >= 0);
+    while (enqueue(data, MAX_SEGMENT_SIZE, NON_BLOCKING_MODE) >= 0);
+
+    pthread_create(&large, NULL, tagged_writer, (void*)LARGE);
+    while (waiting_writers() < 1)
+        sched_yield();
+    pthread_create(&small, NULL, tagged_writer, (void*)SMALL);
+    while (waiting_writers() < 2)
+        sched_yield();
+
+    while (large_pos < 0 || mailslots[MINOR] != NULL || waiting_writers() > 0) {
+        if (dequeue_segment(MINOR, NULL, MAX_SEGMENT_SIZE, BLOCKING_MODE, &msg) < 0)
+            break;
+        h = (header*)message_data(&msg);
+        if (h->producer == LARGE)
+            large_pos = pos;
+        else if (h->producer == SMALL && small_pos < 0)
+            small_pos = pos;
+        release_message(&msg);
+        pos++;
+    }
+
+    pthread_join(large, NULL);
+    pthread_join(small, NULL);
+    while (dequeue_segment(MINOR, NULL, MAX_SEGMENT_SIZE, NON_BLOCKING_MODE, &msg) >= 0)
+        release_message(&msg);
+
+    return large_pos >= 0 && (small_pos < 0 || large_pos < small_pos);
+}
+
+// TTL scenario: a stale backlog, packed and single segments, is dropped in bulk before the fresh message
+int ttl_test(void) {
+    char data[MAX_SEGMENT_SIZE];
+    header* h = (header*)data;
+    message msg;
+    unsigned long long before = expired[MINOR];
+    int i, res, ok;
+
+    memset(data, 0, sizeof(data));
+    mutex_lock(&mutex[MINOR]);
+    ttl[MINOR] = 10000000ULL;   // 10 ms
+    mutex_unlock(&mutex[MINOR]);
+
+    for (i = 0; i < 100; i++) {
+        h->producer = FILLER;
+        enqueue(data, (i % 2) ? 16 : MAX_SEGMENT_SIZE, BLOCKING_MODE);
+    }
+    usleep(20000);
+    h->producer = SMALL;
+    enqueue(data, 16, BLOCKING_MODE);
+
+    res = dequeue_segment(MINOR, NULL, MAX_SEGMENT_SIZE, BLOCKING_MODE, &msg);
+    ok = res == 16 && ((header*)message_data(&msg))->producer == SMALL && expired[MINOR] - before == 100 &&
+            mailslots[MINOR] == NULL && atomic_read(&used_space[MINOR]) == 0 && atomic_read(&used_memory[MINOR]) == 0;
+    if (res >= 0)
+        release_message(&msg);
+
+    mutex_lock(&mutex[MINOR]);
+    ttl[MINOR] = 0;
+    mutex_unlock(&mutex[MINOR]);
+    return ok;
+}
+// partition scenario: producers with their own key, two readers each owning half of the partitions
+#define KEYS 4
+
+partition_reader readers[2];
+atomic_t partition_errors;
+atomic_t partition_consumed;
+
+void* keyed_producer(void* args) {
+    int key = (int)(long)args, i;
+    header h = {key, 0};
+
+    for (i = 0; i < messages; i++) {
+        h.seq = i;
+        enqueue_keyed((char*)&h, sizeof(header), BLOCKING_MODE, key);
+    }
+    return NULL;
+}
+
+void* partition_consumer(void* args) {
+    partition_reader* reader = args;
+    int last_seq[KEYS] = {-1, -1, -1, -1};
+    message msg;
+    header* h;
+
+    while (1) {
+        if (dequeue_segment(MINOR, reader, MAX_SEGMENT_SIZE, BLOCKING_MODE, &msg) < 0) {
+            atomic_add(1, &partition_errors);
+            continue;
+        }
+        h = (header*)message_data(&msg);
+
+        if (h->producer == POISON) {
+            release_message(&msg);
+            break;
+        }
+
+        // only keys of owned partitions, in order
+        if (partition_owner[MINOR][h->producer % NUM_PARTITIONS] != reader || h->seq <= last_seq[h->producer])
+            atomic_add(1, &partition_errors);
+        last_seq[h->producer] = h->seq;
+        release_message(&msg);
+        atomic_add(1, &partition_consumed);
+    }
+    return NULL;
+}
+
+// returns 1 if every message has been read, in key order, by the owner of its partition
+int partition_test(void) {
+    pthread_t producer_tids[KEYS], consumer_tids[2];
+    header poison = {POISON, 0};
+    int i;
+
+    mutex_lock(&mutex[MINOR]);
+    partition_mode[MINOR] = 1;
+    register_reader(MINOR, &readers[0]);
+    register_reader(MINOR, &readers[1]);
+    mutex_unlock(&mutex[MINOR]);
+
+    for (i = 0; i < 2; i++)
+        pthread_create(&consumer_tids[i], NULL, partition_consumer, &readers[i]);
+    for (i = 0; i < KEYS; i++)
+        pthread_create(&producer_tids[i], NULL, keyed_producer, (void*)(long)i);
+    for (i = 0; i < KEYS; i++)
+        pthread_join(producer_tids[i], NULL);
+
+    // partition 0 belongs to the first reader, partition 1 to the second one
+    enqueue_keyed((char*)&poison, sizeof(header), BLOCKING_MODE, 0);
+    enqueue_keyed((char*)&poison, sizeof(header), BLOCKING_MODE, 1);
+    for (i = 0; i < 2; i++)
+        pthread_join(consumer_tids[i], NULL);
+
+    mutex_lock(&mutex[MINOR]);
+    unregister_reader(MINOR, &readers[0]);
+    unregister_reader(MINOR, &readers[1]);
+    partition_mode[MINOR] = 0;
+    mutex_unlock(&mutex[MINOR]);
+
+    return atomic_read(&partition_errors) == 0 && atomic_read(&partition_consumed) == KEYS * messages && mailslots[MINOR] == NULL;
+}
+
+// large message scenario: a segment over MAX_SEGMENT_SIZE lives in a vector of pages and is charged page by page
+int large_message_test(void) {
+    size_t len = 5 * PAGE_SIZE + 123;
+    char* data = malloc(len);
+    char* out = malloc(len);
+    segment* new_msg;
+    message msg;
+    size_t i;
+    int res, ok;
+
+    for (i = 0; i < len; i++)
+        data[i] = (char)(i * 7);
+
+    new_msg = alloc_segment(&pools[MINOR], len, GFP_KERNEL);
+    copy_to_segment(new_msg, data, len);
+    new_msg->size = len;
+    new_msg->orig_size = len;
+    ok = new_msg->pages != NULL && new_msg->nr_pages == 6;
+
+    res = enqueue_segment(MINOR, new_msg, len, BLOCKING_MODE);
+    ok = ok && res == (int)len && atomic_read(&used_memory[MINOR]) >= 6 * (int)PAGE_SIZE;
+
+    res = dequeue_segment(MINOR, NULL, len, BLOCKING_MODE, &msg);
+    ok = ok && res == (int)len && message_data(&msg) == NULL;
+    if (res >= 0) {
+        copy_from_pages(msg.seg, out, len);
+        ok = ok && memcmp(data, out, len) == 0;
+        release_message(&msg);
+    }
+
+    ok = ok && atomic_read(&used_space[MINOR]) == 0 && atomic_read(&used_memory[MINOR]) == 0;
+    free(data);
+    free(out);
+    return ok;
+}
+
+// request/reply scenario: callers wait on REPLY_MINOR for the echo of their request, responders answer by id
+#define REPLY_MINOR (MINOR + 1)
+#define CALLS 1000
+
+atomic_t call_errors;
+
+void* caller(void* args) {
+    header h = {(int)(long)args, 0};
+    header* reply;
+    call_waiter waiter;
+    segment small_msg;
+    int i;
+
+    for (i = 0; i < CALLS; i++) {
+        h.seq = i;
+        register_call(REPLY_MINOR, &waiter, sizeof(header));
+
+        memset(&small_msg, 0, sizeof(segment));
+        small_msg.payload = (char*)&h;
+        small_msg.size = sizeof(header);
+        small_msg.orig_size = sizeof(header);
+        small_msg.meta.call_id = waiter.call_id;
+        if (enqueue_segment(MINOR, &small_msg, sizeof(header), BLOCKING_MODE) < 0) {
+            cancel_call(REPLY_MINOR, &waiter);
+            atomic_add(1, &call_errors);
+            continue;
+        }
+
+        if (wait_reply(REPLY_MINOR, &waiter) != sizeof(header)) {
+            atomic_add(1, &call_errors);
+            continue;
+        }
+        reply = (header*)waiter.reply->payload;
+        if (reply->producer != h.producer || reply->seq != h.seq)
+            atomic_add(1, &call_errors);
+        free_segment(waiter.reply);
+    }
+    return NULL;
+}
+
+void* responder(void* args) {
+    segment* reply;
+    message msg;
+
+    while (1) {
+        if (dequeue_segment(MINOR, NULL, MAX_SEGMENT_SIZE, BLOCKING_MODE, &msg) < 0) {
+            atomic_add(1, &call_errors);
+            continue;
+        }
+        if (((header*)message_data(&msg))->producer == POISON) {
+            release_message(&msg);
+            break;
+        }
+
+        reply = alloc_segment(&pools[REPLY_MINOR], msg.size, GFP_KERNEL);
+        copy_to_segment(reply, message_data(&msg), msg.size);
+        reply->size = msg.size;
+        reply->orig_size = msg.size;
+        if (deliver_reply(REPLY_MINOR, msg.meta.call_id, reply) < 0) {
+            free_segment(reply);
+            atomic_add(1, &call_errors);
+        }
+        release_message(&msg);
+    }
+    return NULL;
+}
+
+// returns 1 if every caller got its own reply and replies nobody waits for are refused
+int call_test(void) {
+    pthread_t* tids = malloc((producers + consumers) * sizeof(pthread_t));
+    header poison = {POISON, 0};
+    segment* stray;
+    int i, ok;
+
+    for (i = 0; i < consumers; i++)
+        pthread_create(&tids[producers + i], NULL, responder, NULL);
+    for (i = 0; i < producers; i++)
+        pthread_create(&tids[i], NULL, caller, (void*)(long)i);
+
+    for (i = 0; i < producers; i++)
+        pthread_join(tids[i], NULL);
+    for (i = 0; i < consumers; i++)
+        enqueue((char*)&poison, sizeof(header), BLOCKING_MODE);
+    for (i = 0; i < consumers; i++)
+        pthread_join(tids[producers + i], NULL);
+
+    stray = alloc_segment(&pools[REPLY_MINOR], sizeof(header), GFP_KERNEL);
+    stray->size = sizeof(header);
+    stray->orig_size = sizeof(header);
+    ok = deliver_reply(REPLY_MINOR, 1, stray) == -ENOENT;
+    free_segment(stray);
+
+    free(tids);
+    return ok && atomic_read(&call_errors) == 0 && call_waiters[REPLY_MINOR] == NULL && mailslots[MINOR] == NULL;
+}
+
+// wakeup steering scenario: the reader hinted on the CPU of the writer is woken up before the one that slept first
+partition_reader hinted[2];
+int steered_seq[2] = {-1, -1};
+atomic_t steered_reads;
+
+int waiting_readers(void) {
+    int n = 0;
+    elem* aux;
+
+    mutex_lock(&mutex[MINOR]);
+    for (aux = readers_list[MINOR].head.next; aux != &(readers_list[MINOR].tail); aux = aux->next)
+        n++;
+    mutex_unlock(&mutex[MINOR]);
+    return n;
+}
+
+void* hinted_reader(void* args) {
+    int i = (int)(long)args;
+    message msg;
+
+    while (dequeue_segment(MINOR, &hinted[i], MAX_SEGMENT_SIZE, BLOCKING_MODE, &msg) < 0);
+    steered_seq[i] = ((header*)message_data(&msg))->seq;
+    release_message(&msg);
+    atomic_add(1, &steered_reads);
+    return NULL;
+}
+
+// returns 1 if the near reader got the first message and the far one, asleep since before it, the second
+int wakeup_steering_test(void) {
+    pthread_t tids[2];
+    header h = {0, 0};
+    int this_cpu = raw_smp_processor_id();
+
+    // hinted[0] sleeps on the same node but another package, hinted[1] on the package of this thread
+    hinted[0].cpu_hint = this_cpu ^ 2;
+    hinted[1].cpu_hint = this_cpu ^ 1;
+
+    mutex_lock(&mutex[MINOR]);
+    cache_wakeup[MINOR] = 1;
+    mutex_unlock(&mutex[MINOR]);
+
+    pthread_create(&tids[0], NULL, hinted_reader, (void*)0L);
+    while (waiting_readers() < 1)
+        usleep(1000);
+    pthread_create(&tids[1], NULL, hinted_reader, (void*)1L);
+    while (waiting_readers() < 2)
+        usleep(1000);
+
+    // one at a time, so that each message is read by the reader it woke up
+    enqueue((char*)&h, sizeof(header), BLOCKING_MODE);
+    while (atomic_read(&steered_reads) < 1)
+        usleep(1000);
+    h.seq = 1;
+    enqueue((char*)&h, sizeof(header), BLOCKING_MODE);
+    pthread_join(tids[0], NULL);
+    pthread_join(tids[1], NULL);
+
+    mutex_lock(&mutex[MINOR]);
+    cache_wakeup[MINOR] = 0;
+    mutex_unlock(&mutex[MINOR]);
+
+    return steered_seq[1] == 0 && steered_seq[0] == 1 && mailslots[MINOR] == NULL;
+}
+
+// cork scenario: a staged batch committed while another writer runs stays contiguous, in order and with its boundaries
+#define PLAIN 2000
+#define STAGED 2001
+#define PLAIN_MESSAGES 2000
+
+int staged_count;
+int staged_ok;
+
+void* plain_writer(void* args) {
+    header h = {PLAIN, 0};
+
+    for (h.seq = 0; h.seq < PLAIN_MESSAGES; h.seq++)
+        enqueue((char*)&h, sizeof(header), BLOCKING_MODE);
+    return NULL;
+}
+
+// returns 1 if the batch is read back as its own messages, one after the other
+int cork_test(void) {
+    pthread_t tid;
+    segment batch;
+    char data[PACKED_MAX_SIZE];
+    header* h = (header*)data;
+    message msg;
+    int res, next = 0, in_batch = 0, done = 0, ok = 1;
+
+    memset(&batch, 0, sizeof(segment));
+    batch.batch = 1;
+    batch.payload = malloc(CORK_BUFFER_SIZE);
+
+    // messages of different sizes, until the buffer is full
+    h->producer = STAGED;
+    for (h->seq = 0; ; h->seq++) {
+        memset(data + sizeof(header), (char)h->seq, h->seq % 16);
+        if (!stage_record(&batch, data, sizeof(header) + h->seq % 16, 0))
+            break;
+    }
+    staged_count = batch.records;
+
+    pthread_create(&tid, NULL, plain_writer, NULL);
+    usleep(1000);
+    res = enqueue_segment(MINOR, &batch, batch.size, BLOCKING_MODE);
+    pthread_join(tid, NULL);
+
+    while (dequeue_segment(MINOR, NULL, MAX_SEGMENT_SIZE, NON_BLOCKING_MODE, &msg) >= 0) {
+        h = (header*)message_data(&msg);
+        if (h->producer == STAGED) {
+            // nothing in between, sizes as staged
+            if (done || h->seq != next || msg.size != sizeof(header) + h->seq % 16 ||
+                    (h->seq % 16 > 0 && ((char*)(h + 1))[h->seq % 16 - 1] != (char)h->seq))
+                ok = 0;
+            in_batch = 1;
+            next++;
+        }
+        else if (in_batch) {
+            in_batch = 0;
+            done = next == staged_count;
+        }
+        release_message(&msg);
+    }
+
+    free(batch.payload);
+    staged_ok = next;
+    return ok && res == batch.size && next == staged_count && mailslots[MINOR] == NULL &&
+            atomic_read(&used_space[MINOR]) == 0 && atomic_read(&used_memory[MINOR]) == 0;
+}
+
+// multicast scenario: one payload shared by three minors, each accounting it, freed with the last reader
+#define TARGETS 3
+
+int multicast_test(void) {
+    size_t len = 3 * PAGE_SIZE;
+    char* data = malloc(len);
+    char* out = malloc(len);
+    segment* owner;
+    segment* new_msg;
+    message msg;
+    size_t i;
+    int minor, ok = 1;
+
+    for (i = 0; i < len; i++)
+        data[i] = (char)(i * 3);
+
+    owner = alloc_segment(&pools[MINOR], len, GFP_KERNEL);
+    copy_to_segment(owner, data, len);
+    owner->size = len;
+    owner->orig_size = len;
+    atomic_set(&owner->refs, 1);
+
+    for (minor = MINOR; minor < MINOR + TARGETS; minor++) {
+        new_msg = share_segment(owner, GFP_KERNEL);
+        ok = ok && enqueue_segment(minor, new_msg, len, BLOCKING_MODE) == (int)len &&
+                atomic_read(&used_memory[minor]) >= 3 * (int)PAGE_SIZE;
+    }
+    put_shared(owner);
+    ok = ok && atomic_read(&owner->refs) == TARGETS;
+
+    for (minor = MINOR; minor < MINOR + TARGETS; minor++) {
+        if (dequeue_segment(minor, NULL, len, BLOCKING_MODE, &msg) != (int)len) {
+            ok = 0;
+            continue;
+        }
+        // the payload is the same, not a copy
+        ok = ok && msg.seg->pages == owner->pages;
+        copy_from_pages(msg.seg, out, len);
+        ok = ok && memcmp(data, out, len) == 0;
+        if (minor < MINOR + TARGETS - 1)
+            ok = ok && atomic_read(&owner->refs) == MINOR + TARGETS - minor;
+        release_message(&msg);
+        ok = ok && atomic_read(&used_space[minor]) == 0 && atomic_read(&used_memory[minor]) == 0;
+    }
+
+    free(data);
+    free(out);
+    return ok;
+}
+
+// pool scenario: a burst after the mailslot has drained takes its segments and pages from the pool
+void burst(void) {
+    char data[3 * PAGE_SIZE];
+    message msg;
+    int i;
+
+    memset(data, 'p', sizeof(data));
+    for (i = 0; i < 100; i++) {
+        enqueue(data, 600, BLOCKING_MODE);
+        enqueue(data, 16, BLOCKING_MODE);
+    }
+    enqueue(data, sizeof(data), BLOCKING_MODE);
+
+    while (dequeue_segment(MINOR, NULL, sizeof(data), NON_BLOCKING_MODE, &msg) >= 0)
+        release_message(&msg);
+}
+
+// returns 1 if the second burst never misses and trimming empties the pool
+int pool_test(void) {
+    segment_pool* pool = &pools[MINOR];
+    unsigned long long misses, hits, trimmed;
+    unsigned long kept;
+
+    pool_trim(pool, ULONG_MAX);
+    trimmed = pool->trimmed;
+
+    burst();
+    misses = pool->misses;
+    hits = pool->hits;
+    kept = pool_size(pool);
+
+    burst();
+    if (pool->misses != misses || pool->hits - hits < kept)
+        return 0;
+
+    return pool_trim(pool, ULONG_MAX) == kept && pool_size(pool) == 0 && pool->trimmed == trimmed + kept &&
+            atomic_read(&used_memory[MINOR]) == 0;
+}
+
+// tail scenario: the reader drains the chunk at the tail while writers pack records in it and link single
+// segments behind it, alternately; no record may be lost with the chunk
+#define ALTERNATING 2
+#define ALTERNATING_MESSAGES 20000
+
+int alternating_errors;
+
+void* alternating_writer(void* args) {
+    int id = (int)(long)args;
+    char data[600];
+    header* h = (header*)data;
+    int i;
+
+    memset(data, 'a', sizeof(data));
+    for (i = 0; i < ALTERNATING_MESSAGES; i++) {
+        h->producer = id;
+        h->seq = i;
+        enqueue(data, (i % 2) ? sizeof(data) : 16, BLOCKING_MODE);
+    }
+    return NULL;
+}
+
+// returns 1 if every message is read in order and the accounting gets back to zero
+int tail_drain_test(void) {
+    pthread_t writers[ALTERNATING];
+    int last_seq[ALTERNATING] = {-1, -1};
+    message msg;
+    header* h;
+    int i, res, count = 0;
+
+    for (i = 0; i < ALTERNATING; i++)
+        pthread_create(&writers[i], NULL, alternating_writer, (void*)(long)i);
+
+    while (count < ALTERNATING * ALTERNATING_MESSAGES) {
+        res = dequeue_segment(MINOR, NULL, 600, BLOCKING_MODE, &msg);
+        if (res < 0) {
+            alternating_errors++;
+            continue;
+        }
+        h = (header*)message_data(&msg);
+        if (h->seq != last_seq[h->producer] + 1)
+            alternating_errors++;
+        last_seq[h->producer] = h->seq;
+        release_message(&msg);
+        count++;
+    }
+
+    for (i = 0; i < ALTERNATING; i++)
+        pthread_join(writers[i], NULL);
+
+    return alternating_errors == 0 && mailslots[MINOR] == NULL && atomic_read(&msg_count[MINOR]) == 0 &&
+            atomic_read(&used_space[MINOR]) == 0 && atomic_read(&used_memory[MINOR]) == 0;
+}
+
+// capacity scenario: small messages between single segments keep filling the same chunk
+#define MIN_ALTERNATING_CAPACITY 5000
+
+// number of messages of alternating sizes a mailslot takes before a non-blocking write fails, drained after
+int alternating_capacity(void) {
+    char data[300];
+    message msg;
+    int count = 0;
+
+    memset(data, 'c', sizeof(data));
+    while (enqueue(data, (count % 2) ? sizeof(data) : 16, NON_BLOCKING_MODE) >= 0)
+        count++;
+
+    while (dequeue_segment(MINOR, NULL, sizeof(data), NON_BLOCKING_MODE, &msg) >= 0)
+        release_message(&msg);
+    return count;
+}
+
+// number of 16 byte messages with interleaved keys a mailslot takes before a non-blocking write fails,
+// drained after; each partition fills a chunk of its own
+#define MIN_INTERLEAVED_CAPACITY 30000
+
+int interleaved_capacity(void) {
+    char data[16];
+    message msg;
+    int count = 0;
+
+    memset(data, 'k', sizeof(data));
+    while (enqueue_keyed(data, sizeof(data), NON_BLOCKING_MODE, count % 2) >= 0)
+        count++;
+
+    while (dequeue_segment(MINOR, NULL, sizeof(data), NON_BLOCKING_MODE, &msg) >= 0)
+        release_message(&msg);
+    return count;
+}
+
+// cleanup scenario: a payload taken from the pool of MINOR is still queued only on another minor when MINOR is
+// cleaned up; returns 1 if trimming after every cleanup leaves no pool holding anything
+int cleanup_test(void) {
+    segment* owner;
+    segment* new_msg;
+    int minor;
+
+    owner = alloc_segment(&pools[MINOR], 3 * PAGE_SIZE, GFP_KERNEL);
+    owner->size = 3 * PAGE_SIZE;
+    owner->orig_size = 3 * PAGE_SIZE;
+    atomic_set(&owner->refs, 1);
+    new_msg = share_segment(owner, GFP_KERNEL);
+    enqueue_segment(MINOR + 2, new_msg, 3 * PAGE_SIZE, BLOCKING_MODE);
+    put_shared(owner);
+
+    for (minor = MINOR; minor < MINOR + 3; minor++)
+        cleanup_mailslot(minor);
+    for (minor = MINOR; minor < MINOR + 3; minor++)
+        pool_trim(&pools[minor], ULONG_MAX);
+
+    for (minor = MINOR; minor < MINOR + 3; minor++)
+        if (pool_size(&pools[minor]) != 0)
+            return 0;
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    int i;
+    pthread_t* threads;
+    header poison = {POISON, 0};
+    mailslot_status* status;
+
+    if (argc > 1)
+        producers = atoi(argv[1]);
+    if (argc > 2)
+        consumers = atoi(argv[2]);
+    if (argc > 3)
+        messages = atoi(argv[3]);
+
+    init_mailslot(MINOR);
+    init_mailslot(REPLY_MINOR);
+    init_mailslot(MINOR + 2);
+    status = get_status_page(MINOR, MAX_SEGMENT_SIZE);
+    threads = malloc((producers + consumers) * sizeof(pthread_t));
+
+    for (i = 0; i < consumers; i++)
+        pthread_create(&threads[producers + i], NULL, consumer, NULL);
+    for (i = 0; i < producers; i++)
+        pthread_create(&threads[i], NULL, producer, (void*)(long)i);
+
+    for (i = 0; i < producers; i++)
+        pthread_join(threads[i], NULL);
+    for (i = 0; i < consumers; i++)
+        enqueue((char*)&poison, sizeof(header), BLOCKING_MODE);
+    for (i = 0; i < consumers; i++)
+        pthread_join(threads[producers + i], NULL);
+
+    printf("%d producers, %d consumers, %d messages each\n", producers, consumers, messages);
+
+    // TEST 1
+    printf("TEST 1: every message consumed - ");
+    if (atomic_read(&consumed) == producers * messages)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED (%d)\n", atomic_read(&consumed));
+
+    // TEST 2
+    printf("TEST 2: FIFO order, sequence numbers and payload integrity - ");
+    if (atomic_read(&errors) == 0)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED (%d errors)\n", atomic_read(&errors));
+
+    // TEST 3
+    printf("TEST 3: accounting back to zero - ");
+    if (mailslots[MINOR] == NULL && atomic_read(&msg_count[MINOR]) == 0 &&
+            atomic_read(&used_space[MINOR]) == 0 && atomic_read(&used_memory[MINOR]) == 0)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED (space %d, memory %d, messages %d)\n",
+                atomic_read(&used_space[MINOR]), atomic_read(&used_memory[MINOR]), atomic_read(&msg_count[MINOR]));
+
+    // TEST 4
+    printf("TEST 4: status page matches the mailslot - ");
+    if (status->seq % 2 == 0 && status->used_space == 0 && status->used_memory == 0 && status->msg_count == 0 &&
+            status->enqueued == producers * messages + consumers && status->dequeued == status->enqueued)
+        printf("PASSED\n");
+    else {
+        printf("NOT PASSED\n");
+        atomic_add(1, &errors);
+    }
+
+    // TEST 5
+    printf("TEST 5: space granted to waiting writers in arrival order - ");
+    if (fairness_test())
+        printf("PASSED\n");
+    else {
+        printf("NOT PASSED\n");
+        atomic_add(1, &errors);
+    }
+
+    // TEST 6
+    printf("TEST 6: expired messages dropped before the fresh one - ");
+    if (ttl_test())
+        printf("PASSED\n");
+    else {
+        printf("NOT PASSED\n");
+        atomic_add(1, &errors);
+    }
+
+    // TEST 7
+    printf("TEST 7: partitioned readers keep per-key order - ");
+    if (partition_test())
+        printf("PASSED\n");
+    else {
+        printf("NOT PASSED (%d errors, %d consumed)\n", atomic_read(&partition_errors), atomic_read(&partition_consumed));
+        atomic_add(1, &errors);
+    }
+
+    // TEST 8
+    printf("TEST 8: large message stored in pages and read back intact - ");
+    if (large_message_test())
+        printf("PASSED\n");
+    else {
+        printf("NOT PASSED\n");
+        atomic_add(1, &errors);
+    }
+
+    // TEST 9
+    printf("TEST 9: every call gets its own reply - ");
+    if (call_test())
+        printf("PASSED\n");
+    else {
+        printf("NOT PASSED (%d errors)\n", atomic_read(&call_errors));
+        atomic_add(1, &errors);
+    }
+
+    // TEST 10
+    printf("TEST 10: reader sharing the cache of the writer woken up first - ");
+    if (wakeup_steering_test())
+        printf("PASSED\n");
+    else {
+        printf("NOT PASSED (near read %d, far read %d)\n", steered_seq[1], steered_seq[0]);
+        atomic_add(1, &errors);
+    }
+
+    // TEST 11
+    printf("TEST 11: corked batch committed in one piece - ");
+    if (cork_test())
+        printf("PASSED\n");
+    else {
+        printf("NOT PASSED (%d of %d staged messages in order)\n", staged_ok, staged_count);
+        atomic_add(1, &errors);
+    }
+
+    // TEST 12
+    printf("TEST 12: multicast payload shared by every minor and freed with the last reader - ");
+    if (multicast_test())
+        printf("PASSED\n");
+    else {
+        printf("NOT PASSED\n");
+        atomic_add(1, &errors);
+    }
+
+    // TEST 13
+    printf("TEST 13: pooled segments and pages reused by the next burst and trimmed - ");
+    if (pool_test())
+        printf("PASSED\n");
+    else {
+        printf("NOT PASSED (hits %llu, misses %llu)\n", pools[MINOR].hits, pools[MINOR].misses);
+        atomic_add(1, &errors);
+    }
+
+    // TEST 14
+    printf("TEST 14: chunk at the tail drained while writers alternate packed and single messages - ");
+    if (tail_drain_test())
+        printf("PASSED\n");
+    else {
+        printf("NOT PASSED (%d errors)\n", alternating_errors);
+        atomic_add(1, &errors);
+    }
+
+    // TEST 15
+    printf("TEST 15: small messages packed in the same chunk between single segments - ");
+    i = alternating_capacity();
+    if (i >= MIN_ALTERNATING_CAPACITY && mailslots[MINOR] == NULL && atomic_read(&used_memory[MINOR]) == 0)
+        printf("PASSED\n");
+    else {
+        printf("NOT PASSED (%d messages)\n", i);
+        atomic_add(1, &errors);
+    }
+
+    // TEST 16
+    printf("TEST 16: small messages with interleaved keys packed in a chunk per partition - ");
+    i = interleaved_capacity();
+    if (i >= MIN_INTERLEAVED_CAPACITY && mailslots[MINOR] == NULL && atomic_read(&used_memory[MINOR]) == 0)
+        printf("PASSED\n");
+    else {
+        printf("NOT PASSED (%d messages)\n", i);
+        atomic_add(1, &errors);
+    }
+
+    // TEST 17
+    printf("TEST 17: pools empty once every mailslot has been cleaned up and trimmed - ");
+    if (cleanup_test())
+        printf("PASSED\n");
+    else {
+        printf("NOT PASSED (%lu left in the pool)\n", pool_size(&pools[MINOR]));
+        atomic_add(1, &errors);
+    }
+
+    free(threads);
+    return (atomic_read(&errors) == 0 && atomic_read(&consumed) == producers * messages) ? 0 : 1;
+}
@@ -0,0 +1,153 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+#include <sys/stat.h>
+#include "const.h"
+
+#define MESSAGES 100
+#define BURST 100000
+
+unsigned long long monotonic_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// writes BURST 16 bytes messages in batches, draining the mailslot in between, and returns the write rate
+double burst_rate(int writer, int reader) {
+    char msg[16], buf[MAX_SEGMENT_SIZE];
+    unsigned long long elapsed = 0, start;
+    int i, j;
+
+    memset(msg, 'b', sizeof(msg));
+    for (i = 0; i < BURST; i += 1000) {
+        start = monotonic_ns();
+        for (j = 0; j < 1000; j++)
+            write(writer, msg, sizeof(msg));
+        ioctl(writer, CORK_CTL, ioctl(writer, GET_CORK_CTL));   // commits what is staged
+        elapsed += monotonic_ns() - start;
+
+        while (read(reader, buf, MAX_SEGMENT_SIZE) > 0);
+    }
+    return BURST * 1e9 / elapsed;
+}
+
+int main(int argc, char** argv) {
+    int i, ok, len, msg[PACKED_MAX_SIZE / sizeof(int) + 1];
+    char buf[MAX_SEGMENT_SIZE];
+    double plain, corked;
+
+
+	if(argc != 3){
+		printf("You should pass MAJOR number and MINOR number as parameters\n");
+		return -1;
+	}
+
+	int major = atoi(argv[1]);
+	int minor = atoi(argv[2]);
+	dev_t device = makedev(major, minor);
+
+    char pathname[80];
+    sprintf(pathname,"/dev/mailslot%d", minor);
+
+	if( mknod(pathname, S_IFCHR|0666, device) == -1 ){
+		if(errno == EEXIST)
+			printf("Pathname '%s' already exists\n",pathname);
+
+        else {
+			printf("ERROR in the creation of the file %s: %s\n", pathname, strerror(errno));
+			return -1;
+        }
+    }
+
+	int writer = open(pathname, O_WRONLY);
+	int reader = open(pathname, O_RDONLY);
+
+	if(writer == -1 || reader == -1) {
+		printf("ERROR while opening the file %s: %s\n", pathname, strerror(errno));
+		return -1;
+    }
+
+    while(ioctl(reader, GET_FREESPACE_SIZE_CTL) < MAX_MAIL_SLOT_SIZE)
+       read(reader, buf, MAX_SEGMENT_SIZE);
+    ioctl(reader, CHANGE_READ_BLOCKING_MODE_CTL, NON_BLOCKING_MODE);
+
+    // TEST 1
+    printf("TEST 1: invalid cork mode and delay refused - ");
+    if (ioctl(writer, CORK_CTL, 2) == -1 && errno == EINVAL && ioctl(writer, CHANGE_CORK_DELAY_CTL, MAX_CORK_DELAY + 1) == -1 &&
+            errno == EINVAL && ioctl(writer, GET_CORK_DELAY_CTL) == CORK_DELAY)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // a long delay, so that only uncork commits
+    ioctl(writer, CHANGE_CORK_DELAY_CTL, MAX_CORK_DELAY);
+    ioctl(writer, CORK_CTL, CORK_ON);
+
+    /* MESSAGES OF SIZE 4 TO 4 + 4 * (MESSAGES - 1) % PACKED_MAX_SIZE, STAGED */
+    for (i = 0; i < MESSAGES; i++) {
+        msg[0] = i;
+        write(writer, msg, sizeof(int) + (i * sizeof(int)) % PACKED_MAX_SIZE);
+    }
+
+    // TEST 2
+    printf("TEST 2: nothing readable while corked - ");
+    if (ioctl(writer, GET_CORK_CTL) == CORK_ON && read(reader, buf, MAX_SEGMENT_SIZE) == -1 && errno == EAGAIN)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 3
+    ioctl(writer, CORK_CTL, CORK_OFF);
+    ok = 1;
+    for (i = 0; i < MESSAGES; i++) {
+        len = read(reader, msg, sizeof(msg));
+        if (len != sizeof(int) + (i * sizeof(int)) % PACKED_MAX_SIZE || msg[0] != i)
+            ok = 0;
+    }
+    printf("TEST 3: uncork commits every message, in order and with its size - ");
+    if (ok && read(reader, buf, MAX_SEGMENT_SIZE) == -1)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 4
+    ioctl(writer, CHANGE_CORK_DELAY_CTL, 10000);
+    ioctl(writer, CORK_CTL, CORK_ON);
+    msg[0] = 1;
+    write(writer, msg, sizeof(int));
+    memset(buf, 'l', 2 * PACKED_MAX_SIZE);
+    write(writer, buf, 2 * PACKED_MAX_SIZE);    // too large to be staged, goes after the first one
+    msg[0] = 3;
+    write(writer, msg, sizeof(int));
+    ok = read(reader, msg, sizeof(msg)) == sizeof(int) && msg[0] == 1;
+    ok = ok && read(reader, buf, MAX_SEGMENT_SIZE) == 2 * PACKED_MAX_SIZE;
+    usleep(100000);
+    ok = ok && read(reader, msg, sizeof(msg)) == sizeof(int) && msg[0] == 3;
+    printf("TEST 4: large writes go after the staged ones, staged ones committed after the delay - ");
+    if (ok)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    ioctl(writer, CORK_CTL, CORK_OFF);
+    ioctl(writer, CHANGE_CORK_DELAY_CTL, CORK_DELAY);
+
+    plain = burst_rate(writer, reader);
+    ioctl(writer, CORK_CTL, CORK_ON);
+    corked = burst_rate(writer, reader);
+    ioctl(writer, CORK_CTL, CORK_OFF);
+    printf("16 bytes writes: %.0f msg/s plain, %.0f msg/s corked\n", plain, corked);
+
+    ioctl(reader, CHANGE_READ_BLOCKING_MODE_CTL, BLOCKING_MODE);
+    close(reader);
+    close(writer);
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include "const.h"
+
+
+// returns the eventfd counter (0 if not signalled)
+uint64_t poll_eventfd(int efd) {
+    uint64_t value = 0;
+    if (read(efd, &value, sizeof(value)) < 0)
+        return 0;
+    return value;
+}
+
+
+int main(int argc, char** argv) {
+    int i;
+    char read_buf[MAX_SEGMENT_SIZE];
+    eventfd_binding binding;
+
+
+	if(argc != 3){
+		printf("You should pass MAJOR number and MINOR number as parameters\n");
+		return -1;
+	}
+
+	int major = atoi(argv[1]);
+	int minor = atoi(argv[2]);
+	dev_t device = makedev(major, minor);
+
+    char pathname[80];
+    sprintf(pathname,"/dev/mailslot%d", minor);
+
+	if( mknod(pathname, S_IFCHR|0666, device) == -1 ){
+		if(errno == EEXIST)
+			printf("Pathname '%s' already exists\n",pathname);
+
+        else {
+			printf("ERROR in the creation of the file %s: %s\n", pathname, strerror(errno));
+			return -1;
+        }
+    }
+
+	int fd = open(pathname, 0666);
+
+	if(fd == -1) {
+		printf("ERROR while opening the file %s: %s\n", pathname, strerror(errno));
+		return -1;
+    }
+
+    while(ioctl(fd, GET_FREESPACE_SIZE_CTL) < MAX_MAIL_SLOT_SIZE)
+       read(fd, read_buf, MAX_SEGMENT_SIZE);
+
+    int efd = eventfd(0, EFD_NONBLOCK);
+    if (efd == -1) {
+        printf("ERROR while creating the eventfd: %s\n", strerror(errno));
+        return -1;
+    }
+
+    binding.fd = efd;
+    binding.events = NOTIFY_NON_EMPTY | NOTIFY_DEPTH;
+    binding.depth = 4;
+    if (ioctl(fd, BIND_EVENTFD_CTL, &binding) < 0) {
+        printf("ERROR in ioctl: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // TEST 1
+    printf("TEST 1: empty to non-empty - ");
+    write(fd, "test", 5);
+    if (poll_eventfd(efd) == 1)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 2
+    printf("TEST 2: no signal below depth - ");
+    write(fd, "test", 5);
+    write(fd, "test", 5);
+    if (poll_eventfd(efd) == 0)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 3
+    printf("TEST 3: depth reached - ");
+    write(fd, "test", 5);
+    if (poll_eventfd(efd) == 1)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    binding.events = NOTIFY_SPACE;
+    ioctl(fd, BIND_EVENTFD_CTL, &binding);
+
+    // TEST 4
+    printf("TEST 4: space freed - ");
+    for (i = 0; i < 4; i++)
+        read(fd, read_buf, MAX_SEGMENT_SIZE);
+    if (poll_eventfd(efd) == 4)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    binding.fd = -1;
+    ioctl(fd, BIND_EVENTFD_CTL, &binding);
+
+    close(efd);
+    close(fd);
+    return 0;
+}
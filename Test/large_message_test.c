@@ -0,0 +1,109 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+#include <sys/stat.h>
+#include "const.h"
+
+#define LARGE_SIZE (256*1024)
+
+
+// fills buf with a pattern that changes at every page, so that misplaced pages are detected
+void fill(char* buf, int len) {
+    int i;
+
+    for (i = 0; i < len; i++)
+        buf[i] = (char)(i / 4096 + i % 251);
+}
+
+int main(int argc, char** argv) {
+    char* buf = malloc(MAX_MESSAGE_SIZE);
+    char* out = malloc(MAX_MESSAGE_SIZE);
+
+
+	if(argc != 3){
+		printf("You should pass MAJOR number and MINOR number as parameters\n");
+		return -1;
+	}
+
+	int major = atoi(argv[1]);
+	int minor = atoi(argv[2]);
+	dev_t device = makedev(major, minor);
+
+    char pathname[80];
+    sprintf(pathname,"/dev/mailslot%d", minor);
+
+	if( mknod(pathname, S_IFCHR|0666, device) == -1 ){
+		if(errno == EEXIST)
+			printf("Pathname '%s' already exists\n",pathname);
+
+        else {
+			printf("ERROR in the creation of the file %s: %s\n", pathname, strerror(errno));
+			return -1;
+        }
+    }
+
+	int fd = open(pathname, 0666);
+
+	if(fd == -1) {
+		printf("ERROR while opening the file %s: %s\n", pathname, strerror(errno));
+		return -1;
+    }
+
+    ioctl(fd, CHANGE_MAX_SEGMENT_SIZE_CTL, MAX_MESSAGE_SIZE);
+    while(ioctl(fd, GET_FREESPACE_SIZE_CTL) < MAX_MAIL_SLOT_SIZE)
+       read(fd, out, MAX_MESSAGE_SIZE);
+
+    // TEST 1
+    printf("TEST 1: max segment size raised over the default - ");
+    if (ioctl(fd, CHANGE_MAX_SEGMENT_SIZE_CTL, LARGE_SIZE) == 0 && ioctl(fd, GET_MAX_SEGMENT_SIZE_CTL) == LARGE_SIZE)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 2
+    printf("TEST 2: max segment size over the mailslot size refused - ");
+    if (ioctl(fd, CHANGE_MAX_SEGMENT_SIZE_CTL, MAX_MESSAGE_SIZE + 1) == -1 && ioctl(fd, GET_MAX_SEGMENT_SIZE_CTL) == LARGE_SIZE)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 3
+    fill(buf, LARGE_SIZE);
+    memset(out, 0, LARGE_SIZE);
+    printf("TEST 3: large message read back intact in one read - ");
+    if (write(fd, buf, LARGE_SIZE) == LARGE_SIZE && read(fd, out, LARGE_SIZE) == LARGE_SIZE && memcmp(buf, out, LARGE_SIZE) == 0)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 4
+    write(fd, buf, LARGE_SIZE);
+    printf("TEST 4: short buffer refused, message left in the mailslot - ");
+    if (read(fd, out, LARGE_SIZE - 1) == -1 && ioctl(fd, GET_FREESPACE_SIZE_CTL) == MAX_MAIL_SLOT_SIZE - LARGE_SIZE)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+    read(fd, out, LARGE_SIZE);
+
+    // TEST 5
+    ioctl(fd, CHANGE_MAX_SEGMENT_SIZE_CTL, MAX_MESSAGE_SIZE);
+    fill(buf, MAX_MESSAGE_SIZE);
+    memset(out, 0, MAX_MESSAGE_SIZE);
+    printf("TEST 5: message as large as the mailslot - ");
+    if (write(fd, buf, MAX_MESSAGE_SIZE) == MAX_MESSAGE_SIZE && read(fd, out, MAX_MESSAGE_SIZE) == MAX_MESSAGE_SIZE &&
+            memcmp(buf, out, MAX_MESSAGE_SIZE) == 0)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    ioctl(fd, CHANGE_MAX_SEGMENT_SIZE_CTL, MAX_SEGMENT_SIZE);
+    close(fd);
+    free(buf);
+    free(out);
+    return 0;
+}
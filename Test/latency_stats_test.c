@@ -0,0 +1,115 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+#include <sys/stat.h>
+#include "const.h"
+
+
+unsigned long long hist_count(lat_hist* hist) {
+    int i;
+    unsigned long long total = 0;
+
+    for (i = 0; i < LAT_HIST_BUCKETS; i++)
+        total += hist->bucket[i];
+    return total;
+}
+
+void print_hist(const char* name, lat_hist* hist) {
+    int i;
+
+    printf("%s: %llu samples\n", name, hist_count(hist));
+    for (i = 0; i < LAT_HIST_BUCKETS; i++)
+        if (hist->bucket[i] != 0)
+            printf("    < %10llu ns: %llu\n", 1ULL << i, hist->bucket[i]);
+}
+
+
+int main(int argc, char** argv) {
+    int i, ret;
+    char read_buf[MAX_SEGMENT_SIZE];
+    latency_stats stats;
+
+
+	if(argc != 3){
+		printf("You should pass MAJOR number and MINOR number as parameters\n");
+		return -1;
+	}
+
+	int major = atoi(argv[1]);
+	int minor = atoi(argv[2]);
+	dev_t device = makedev(major, minor);
+
+    char pathname[80];
+    sprintf(pathname,"/dev/mailslot%d", minor);
+
+	if( mknod(pathname, S_IFCHR|0666, device) == -1 ){
+		if(errno == EEXIST)
+			printf("Pathname '%s' already exists\n",pathname);
+
+        else {
+			printf("ERROR in the creation of the file %s: %s\n", pathname, strerror(errno));
+			return -1;
+        }
+    }
+
+	int fd = open(pathname, 0666);
+
+	if(fd == -1) {
+		printf("ERROR while opening the file %s: %s\n", pathname, strerror(errno));
+		return -1;
+    }
+
+    while(ioctl(fd, GET_FREESPACE_SIZE_CTL) < MAX_MAIL_SLOT_SIZE)
+       read(fd, read_buf, MAX_SEGMENT_SIZE);
+
+    ioctl(fd, RESET_LATENCY_STATS_CTL);
+
+    for (i = 0; i < N; i++) {
+        write(fd, "test", 5);
+        read(fd, read_buf, MAX_SEGMENT_SIZE);
+    }
+
+    ret = ioctl(fd, GET_LATENCY_STATS_CTL, &stats);
+    if (ret < 0) {
+        printf("ERROR in ioctl: %s\n", strerror(errno));
+        return -1;
+    }
+
+    print_hist("read lock wait", &stats.read_lock_wait);
+    print_hist("read lock hold", &stats.read_lock_hold);
+    print_hist("write lock wait", &stats.write_lock_wait);
+    print_hist("write lock hold", &stats.write_lock_hold);
+    print_hist("read blocked", &stats.read_blocked);
+    print_hist("write blocked", &stats.write_blocked);
+    print_hist("residency", &stats.residency);
+
+    // TEST 1
+    printf("TEST 1: one lock wait and hold sample per read and per write - ");
+    if (hist_count(&stats.read_lock_wait) == N && hist_count(&stats.read_lock_hold) == N &&
+            hist_count(&stats.write_lock_wait) == N && hist_count(&stats.write_lock_hold) == N)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 2
+    printf("TEST 2: one residency sample per message read - ");
+    if (hist_count(&stats.residency) == N)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 3
+    printf("TEST 3: nobody blocked, each read finding its message - ");
+    if (hist_count(&stats.read_blocked) == 0 && hist_count(&stats.write_blocked) == 0)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,142 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+#include <sys/stat.h>
+#include "const.h"
+
+/*
+ * Writes the same messages to TARGETS minors, starting from the one given, with MULTICAST_CTL
+ * and reads them back from every minor. A file open read-only is refused as a target.
+ */
+
+#define TARGETS 3
+
+int fds[TARGETS];
+
+// opens /dev/mailslot<minor>, creating it if needed, and empties it
+int open_minor(int major, int minor) {
+    char pathname[80], buf[MAX_SEGMENT_SIZE];
+    int fd;
+
+    sprintf(pathname,"/dev/mailslot%d", minor);
+	if (mknod(pathname, S_IFCHR|0666, makedev(major, minor)) == -1 && errno != EEXIST) {
+        printf("ERROR in the creation of the file %s: %s\n", pathname, strerror(errno));
+        return -1;
+    }
+
+	fd = open(pathname, 0666);
+	if(fd == -1) {
+		printf("ERROR while opening the file %s: %s\n", pathname, strerror(errno));
+		return -1;
+    }
+
+    while(ioctl(fd, GET_FREESPACE_SIZE_CTL) < MAX_MAIL_SLOT_SIZE)
+       read(fd, buf, MAX_SEGMENT_SIZE);
+    return fd;
+}
+
+// returns 1 if every minor reads back len bytes equal to data
+int read_back(char* data, int len) {
+    char* out = malloc(len);
+    int i, ok = 1;
+
+    for (i = 0; i < TARGETS; i++)
+        if (read(fds[i], out, len) != len || memcmp(data, out, len) != 0)
+            ok = 0;
+    free(out);
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    char small[64], large[3 * MAX_SEGMENT_SIZE], pathname[80];
+    multicast mc;
+    int i, res, rdonly;
+
+
+	if(argc != 3){
+		printf("You should pass MAJOR number and MINOR number as parameters\n");
+		return -1;
+	}
+
+	int major = atoi(argv[1]);
+	int minor = atoi(argv[2]);
+
+    for (i = 0; i < TARGETS; i++) {
+        fds[i] = open_minor(major, minor + i);
+        if (fds[i] == -1)
+            return -1;
+        mc.fds[i] = fds[i];
+    }
+    mc.nr_fds = TARGETS;
+
+    // TEST 1
+    mc.buf = small;
+    mc.len = sizeof(small);
+    mc.nr_fds = MAX_MULTICAST + 1;
+    printf("TEST 1: too many files refused - ");
+    if (ioctl(fds[0], MULTICAST_CTL, &mc) == -1 && errno == EINVAL)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+    mc.nr_fds = TARGETS;
+
+    // TEST 2
+    memset(small, 's', sizeof(small));
+    res = ioctl(fds[0], MULTICAST_CTL, &mc);
+    printf("TEST 2: small message on every minor - ");
+    if (res == TARGETS && mc.results[0] == sizeof(small) && read_back(small, sizeof(small)))
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 3
+    for (i = 0; i < sizeof(large); i++)
+        large[i] = (char)i;
+    for (i = 0; i < TARGETS; i++)
+        ioctl(fds[i], CHANGE_MAX_SEGMENT_SIZE_CTL, sizeof(large));
+    mc.buf = large;
+    mc.len = sizeof(large);
+    res = ioctl(fds[0], MULTICAST_CTL, &mc);
+    printf("TEST 3: shared payload on every minor - ");
+    if (res == TARGETS && read_back(large, sizeof(large)))
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 4
+    ioctl(fds[TARGETS - 1], CHANGE_MAX_SEGMENT_SIZE_CTL, MAX_SEGMENT_SIZE);
+    res = ioctl(fds[0], MULTICAST_CTL, &mc);
+    printf("TEST 4: a minor refusing the message does not stop the others - ");
+    if (res == TARGETS - 1 && mc.results[TARGETS - 1] == -EMSGSIZE && mc.results[0] == sizeof(large))
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 5
+    sprintf(pathname,"/dev/mailslot%d", minor + TARGETS - 1);
+    rdonly = open(pathname, O_RDONLY);
+    mc.fds[TARGETS - 1] = rdonly;
+    mc.buf = small;
+    mc.len = sizeof(small);
+    res = ioctl(fds[0], MULTICAST_CTL, &mc);
+    printf("TEST 5: a file open read-only is not written to - ");
+    if (res == TARGETS - 1 && mc.results[TARGETS - 1] == -EBADF &&
+            ioctl(fds[TARGETS - 1], GET_FREESPACE_SIZE_CTL) == MAX_MAIL_SLOT_SIZE)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+    close(rdonly);
+
+    for (i = 0; i < TARGETS; i++) {
+        while(ioctl(fds[i], GET_FREESPACE_SIZE_CTL) < MAX_MAIL_SLOT_SIZE)
+            read(fds[i], large, sizeof(large));
+        ioctl(fds[i], CHANGE_MAX_SEGMENT_SIZE_CTL, MAX_SEGMENT_SIZE);
+        close(fds[i]);
+    }
+    return 0;
+}
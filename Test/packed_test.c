@@ -0,0 +1,99 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+#include <sys/stat.h>
+#include "const.h"
+
+
+int main(int argc, char** argv) {
+    int ret, count = 0, i, ordered = 1;
+    unsigned char c;
+    char read_buf[MAX_SEGMENT_SIZE];
+
+
+	if(argc != 3){
+		printf("You should pass MAJOR number and MINOR number as parameters\n");
+		return -1;
+	}
+
+	int major = atoi(argv[1]);
+	int minor = atoi(argv[2]);
+	dev_t device = makedev(major, minor);
+
+    char pathname[80];
+    sprintf(pathname,"/dev/mailslot%d", minor);
+
+	if( mknod(pathname, S_IFCHR|0666, device) == -1 ){
+		if(errno == EEXIST)
+			printf("Pathname '%s' already exists\n",pathname);
+
+        else {
+			printf("ERROR in the creation of the file %s: %s\n", pathname, strerror(errno));
+			return -1;
+        }
+    }
+
+	int fd = open(pathname, 0666);
+
+	if(fd == -1) {
+		printf("ERROR while opening the file %s: %s\n", pathname, strerror(errno));
+		return -1;
+    }
+
+    while(ioctl(fd, GET_FREESPACE_SIZE_CTL) < MAX_MAIL_SLOT_SIZE)
+       read(fd, read_buf, MAX_SEGMENT_SIZE);
+
+    // TEST 1
+    printf("TEST 1: empty mailslot uses no memory - ");
+    if (ioctl(fd, GET_USED_MEMORY_CTL) == 0)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    /* FILL WITH 1-BYTE MESSAGES */
+    ioctl(fd, CHANGE_WRITE_BLOCKING_MODE_CTL, NON_BLOCKING_MODE);
+    c = 0;
+    while (write(fd, &c, 1) > 0) {
+        count++;
+        c++;
+    }
+    ioctl(fd, CHANGE_WRITE_BLOCKING_MODE_CTL, BLOCKING_MODE);
+
+    ret = ioctl(fd, GET_USED_MEMORY_CTL);
+    printf("%d messages of 1 byte stored in %d bytes of memory (%.1f bytes per message)\n", count, ret, (double)ret / count);
+
+    // TEST 2
+    printf("TEST 2: memory bounded - ");
+    if (ret <= MAX_MAIL_SLOT_MEMORY)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 3
+    printf("TEST 3: FIFO order of packed messages - ");
+    c = 0;
+    for (i = 0; i < count; i++) {
+        if (read(fd, read_buf, MAX_SEGMENT_SIZE) != 1 || (unsigned char)read_buf[0] != c)
+            ordered = 0;
+        c++;
+    }
+    if (ordered)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 4
+    printf("TEST 4: drained mailslot releases memory - ");
+    if (ioctl(fd, GET_USED_MEMORY_CTL) == 0)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,124 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+#include <sys/stat.h>
+#include "const.h"
+
+#define KEYS 4
+#define MESSAGES 5
+
+// reads everything available to fd, returns 1 if all keys have the given parity and are in order
+int drain(int fd, int parity, int* count) {
+    int msg[2], last[KEYS] = {-1, -1, -1, -1}, ok = 1;
+
+    *count = 0;
+    while (read(fd, msg, sizeof(msg)) == sizeof(msg)) {
+        if (msg[0] % 2 != parity || msg[1] <= last[msg[0]])
+            ok = 0;
+        last[msg[0]] = msg[1];
+        (*count)++;
+    }
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    int i, k, msg[2], count_a, count_b, ok_a, ok_b;
+    char buf[MAX_SEGMENT_SIZE];
+
+
+	if(argc != 3){
+		printf("You should pass MAJOR number and MINOR number as parameters\n");
+		return -1;
+	}
+
+	int major = atoi(argv[1]);
+	int minor = atoi(argv[2]);
+	dev_t device = makedev(major, minor);
+
+    char pathname[80];
+    sprintf(pathname,"/dev/mailslot%d", minor);
+
+	if( mknod(pathname, S_IFCHR|0666, device) == -1 ){
+		if(errno == EEXIST)
+			printf("Pathname '%s' already exists\n",pathname);
+
+        else {
+			printf("ERROR in the creation of the file %s: %s\n", pathname, strerror(errno));
+			return -1;
+        }
+    }
+
+    // the writer does not take part in the partitions
+	int writer = open(pathname, O_WRONLY);
+	int reader_a = open(pathname, O_RDONLY);
+	int reader_b = open(pathname, O_RDONLY);
+
+	if(writer == -1 || reader_a == -1 || reader_b == -1) {
+		printf("ERROR while opening the file %s: %s\n", pathname, strerror(errno));
+		return -1;
+    }
+
+    while(ioctl(reader_a, GET_FREESPACE_SIZE_CTL) < MAX_MAIL_SLOT_SIZE)
+       read(reader_a, buf, MAX_SEGMENT_SIZE);
+
+    // TEST 1
+    printf("TEST 1: partitions spread between the two readers - ");
+    if (ioctl(reader_a, GET_PARTITION_COUNT_CTL) == NUM_PARTITIONS / 2 && ioctl(reader_b, GET_PARTITION_COUNT_CTL) == NUM_PARTITIONS / 2 &&
+            ioctl(writer, GET_PARTITION_COUNT_CTL) == 0)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    ioctl(writer, CHANGE_PARTITION_MODE_CTL, PARTITION_ON);
+    ioctl(reader_a, CHANGE_READ_BLOCKING_MODE_CTL, NON_BLOCKING_MODE);
+
+    /* INTERLEAVED MESSAGES OF KEYS 0-3 */
+    for (i = 0; i < MESSAGES; i++)
+        for (k = 0; k < KEYS; k++) {
+            ioctl(writer, SET_PARTITION_KEY_CTL, k);
+            msg[0] = k;
+            msg[1] = i;
+            write(writer, msg, sizeof(msg));
+        }
+
+    // the first reader owns the even partitions, the second one the odd partitions
+    ok_a = drain(reader_a, 0, &count_a);
+    ok_b = drain(reader_b, 1, &count_b);
+
+    // TEST 2
+    printf("TEST 2: each reader gets only its keys, in order - ");
+    if (ok_a && ok_b && count_a == MESSAGES * KEYS / 2 && count_b == MESSAGES * KEYS / 2)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 3
+    close(reader_b);
+    printf("TEST 3: partitions rebalanced on release - ");
+    if (ioctl(reader_a, GET_PARTITION_COUNT_CTL) == NUM_PARTITIONS)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 4
+    int both = open(pathname, O_RDWR);
+    printf("TEST 4: file open for reading and writing takes partitions from its first read - ");
+    ok_a = ioctl(both, GET_PARTITION_COUNT_CTL) == 0 && ioctl(reader_a, GET_PARTITION_COUNT_CTL) == NUM_PARTITIONS;
+    read(both, buf, MAX_SEGMENT_SIZE);
+    if (ok_a && ioctl(both, GET_PARTITION_COUNT_CTL) == NUM_PARTITIONS / 2)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+    close(both);
+
+    ioctl(writer, CHANGE_PARTITION_MODE_CTL, PARTITION_OFF);
+    ioctl(reader_a, CHANGE_READ_BLOCKING_MODE_CTL, BLOCKING_MODE);
+    close(reader_a);
+    close(writer);
+    return 0;
+}
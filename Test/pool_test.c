@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+#include <sys/stat.h>
+#include "const.h"
+
+/*
+ * Fills the mailslot with a burst of packed and single messages, drains it and repeats the burst:
+ * the second one should be served by the pool of the minor (GET_POOL_STATS_CTL) without misses.
+ * Trimming happens only under memory pressure, e.g. after echo 2 > /proc/sys/vm/drop_caches.
+ */
+
+#define MESSAGES 200
+
+void burst(int fd) {
+    char buf[MAX_SEGMENT_SIZE];
+    int i;
+
+    memset(buf, 'p', sizeof(buf));
+    for (i = 0; i < MESSAGES; i++) {
+        write(fd, buf, 16);
+        write(fd, buf, 600);
+    }
+    while (read(fd, buf, MAX_SEGMENT_SIZE) > 0);
+}
+
+int main(int argc, char** argv) {
+    pool_stats first, second;
+    char read_buf[MAX_SEGMENT_SIZE];
+
+
+	if(argc != 3){
+		printf("You should pass MAJOR number and MINOR number as parameters\n");
+		return -1;
+	}
+
+	int major = atoi(argv[1]);
+	int minor = atoi(argv[2]);
+	dev_t device = makedev(major, minor);
+
+    char pathname[80];
+    sprintf(pathname,"/dev/mailslot%d", minor);
+
+	if( mknod(pathname, S_IFCHR|0666, device) == -1 ){
+		if(errno == EEXIST)
+			printf("Pathname '%s' already exists\n",pathname);
+
+        else {
+			printf("ERROR in the creation of the file %s: %s\n", pathname, strerror(errno));
+			return -1;
+        }
+    }
+
+	int fd = open(pathname, 0666);
+
+	if(fd == -1) {
+		printf("ERROR while opening the file %s: %s\n", pathname, strerror(errno));
+		return -1;
+    }
+
+    while(ioctl(fd, GET_FREESPACE_SIZE_CTL) < MAX_MAIL_SLOT_SIZE)
+       read(fd, read_buf, MAX_SEGMENT_SIZE);
+    ioctl(fd, CHANGE_READ_BLOCKING_MODE_CTL, NON_BLOCKING_MODE);
+
+    burst(fd);
+    ioctl(fd, GET_POOL_STATS_CTL, &first);
+
+    // TEST 1
+    printf("TEST 1: drained segments and pages kept in the pool - ");
+    if (first.segments > 0 && first.pages > 0 && first.segments <= POOL_MAX && first.pages <= POOL_MAX)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    burst(fd);
+    ioctl(fd, GET_POOL_STATS_CTL, &second);
+
+    // TEST 2
+    printf("TEST 2: second burst served by the pool - ");
+    if (second.misses == first.misses && second.hits >= first.hits + first.segments + first.pages)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    printf("hits %llu, misses %llu, trimmed %llu, kept %d segments and %d pages\n",
+            second.hits, second.misses, second.trimmed, second.segments, second.pages);
+
+    ioctl(fd, CHANGE_READ_BLOCKING_MODE_CTL, BLOCKING_MODE);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,128 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+#include <sys/stat.h>
+#include "const.h"
+
+
+unsigned long long monotonic_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(int argc, char** argv) {
+    int i, ret, ordered = 1, stamped = 1;
+    char buf[MAX_SEGMENT_SIZE];
+    read_ext ext;
+    unsigned long long before, after, first_seq = 0;
+
+
+	if(argc != 3){
+		printf("You should pass MAJOR number and MINOR number as parameters\n");
+		return -1;
+	}
+
+	int major = atoi(argv[1]);
+	int minor = atoi(argv[2]);
+	dev_t device = makedev(major, minor);
+
+    char pathname[80];
+    sprintf(pathname,"/dev/mailslot%d", minor);
+
+	if( mknod(pathname, S_IFCHR|0666, device) == -1 ){
+		if(errno == EEXIST)
+			printf("Pathname '%s' already exists\n",pathname);
+
+        else {
+			printf("ERROR in the creation of the file %s: %s\n", pathname, strerror(errno));
+			return -1;
+        }
+    }
+
+	int fd = open(pathname, 0666);
+
+	if(fd == -1) {
+		printf("ERROR while opening the file %s: %s\n", pathname, strerror(errno));
+		return -1;
+    }
+
+    while(ioctl(fd, GET_FREESPACE_SIZE_CTL) < MAX_MAIL_SLOT_SIZE)
+       read(fd, buf, MAX_SEGMENT_SIZE);
+
+    /* WRITE 10 MESSAGES OF INCREASING SIZE, SMALL (PACKED) AND LARGE */
+    before = monotonic_ns();
+    for (i = 0; i < 10; i++) {
+        memset(buf, 'a' + i, 100 * (i + 1));
+        write(fd, buf, 100 * (i + 1));
+    }
+    after = monotonic_ns();
+
+    ext.buf = buf;
+    for (i = 0; i < 10; i++) {
+        ext.len = MAX_SEGMENT_SIZE;
+        ret = ioctl(fd, READ_EXT_CTL, &ext);
+        if (i == 0)
+            first_seq = ext.seq;
+
+        if (ret != 100 * (i + 1) || buf[0] != 'a' + i || ext.seq != first_seq + i)
+            ordered = 0;
+        if (ext.enqueue_time < before || ext.enqueue_time > after || ext.dequeue_time < ext.enqueue_time)
+            stamped = 0;
+    }
+
+    // TEST 1
+    printf("TEST 1: payloads and consecutive sequence numbers - ");
+    if (ordered)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 2
+    printf("TEST 2: enqueue and dequeue timestamps - ");
+    if (stamped)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 3
+    write(fd, buf, 100);
+    ext.len = 10;
+    printf("TEST 3: extended read with a buffer too small - ");
+    if (ioctl(fd, READ_EXT_CTL, &ext) == -1 && errno == EINVAL)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 4
+    ext.len = MAX_SEGMENT_SIZE;
+    ioctl(fd, READ_EXT_CTL, &ext);
+    printf("TEST 4: sequence number keeps counting after a failed read - ");
+    if (ext.seq == first_seq + 10)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 5
+    int wronly = open(pathname, O_WRONLY);
+    write(wronly, buf, 100);
+    ext.len = MAX_SEGMENT_SIZE;
+    printf("TEST 5: extended read on a file open write-only refused - ");
+    if (ioctl(wronly, READ_EXT_CTL, &ext) == -1 && errno == EBADF && ioctl(fd, GET_FREESPACE_SIZE_CTL) < MAX_MAIL_SLOT_SIZE)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+    close(wronly);
+
+    while(ioctl(fd, GET_FREESPACE_SIZE_CTL) < MAX_MAIL_SLOT_SIZE)
+       read(fd, buf, MAX_SEGMENT_SIZE);
+    close(fd);
+    return 0;
+}
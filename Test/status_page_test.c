@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/sysmacros.h>
+#include <sys/stat.h>
+#include "const.h"
+
+
+// consistent copy of the status page, retried while an update is in progress
+void read_status(volatile mailslot_status* status, mailslot_status* copy) {
+    unsigned int seq;
+
+    do {
+        seq = status->seq;
+        __sync_synchronize();
+        memcpy(copy, (void*)status, sizeof(mailslot_status));
+        __sync_synchronize();
+    } while ((seq & 1) || seq != status->seq);
+}
+
+int main(int argc, char** argv) {
+    int i;
+    char buf[MAX_SEGMENT_SIZE];
+    volatile mailslot_status* status;
+    mailslot_status snap;
+    unsigned long long enqueued;
+
+
+	if(argc != 3){
+		printf("You should pass MAJOR number and MINOR number as parameters\n");
+		return -1;
+	}
+
+	int major = atoi(argv[1]);
+	int minor = atoi(argv[2]);
+	dev_t device = makedev(major, minor);
+
+    char pathname[80];
+    sprintf(pathname,"/dev/mailslot%d", minor);
+
+	if( mknod(pathname, S_IFCHR|0666, device) == -1 ){
+		if(errno == EEXIST)
+			printf("Pathname '%s' already exists\n",pathname);
+
+        else {
+			printf("ERROR in the creation of the file %s: %s\n", pathname, strerror(errno));
+			return -1;
+        }
+    }
+
+	int fd = open(pathname, O_RDWR);
+
+	if(fd == -1) {
+		printf("ERROR while opening the file %s: %s\n", pathname, strerror(errno));
+		return -1;
+    }
+
+    while(ioctl(fd, GET_FREESPACE_SIZE_CTL) < MAX_MAIL_SLOT_SIZE)
+       read(fd, buf, MAX_SEGMENT_SIZE);
+
+    // TEST 1
+    printf("TEST 1: writable mapping refused - ");
+    if (mmap(NULL, getpagesize(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) == MAP_FAILED)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    status = mmap(NULL, getpagesize(), PROT_READ, MAP_SHARED, fd, 0);
+    if (status == MAP_FAILED) {
+        printf("ERROR while mapping the status page: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // TEST 2
+    printf("TEST 2: read-only mapping cannot be made writable - ");
+    if (mprotect((void*)status, getpagesize(), PROT_READ | PROT_WRITE) == -1)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 3
+    read_status(status, &snap);
+    printf("TEST 3: limits exposed - ");
+    if (snap.max_size == MAX_MAIL_SLOT_SIZE && snap.max_memory == MAX_MAIL_SLOT_MEMORY &&
+            snap.max_segment_size == ioctl(fd, GET_MAX_SEGMENT_SIZE_CTL))
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    /* WRITE 10 MESSAGES */
+    enqueued = snap.enqueued;
+    memset(buf, 'a', 100);
+    for (i = 0; i < 10; i++)
+        write(fd, buf, 100);
+
+    // TEST 4
+    read_status(status, &snap);
+    printf("TEST 4: live values after writes - ");
+    if (snap.msg_count == 10 && snap.enqueued == enqueued + 10 &&
+            snap.max_size - snap.used_space == ioctl(fd, GET_FREESPACE_SIZE_CTL) &&
+            snap.used_memory == ioctl(fd, GET_USED_MEMORY_CTL))
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    /* READ THEM BACK */
+    for (i = 0; i < 10; i++)
+        read(fd, buf, MAX_SEGMENT_SIZE);
+
+    // TEST 5
+    read_status(status, &snap);
+    printf("TEST 5: live values after reads - ");
+    if (snap.msg_count == 0 && snap.used_space == 0 && snap.dequeued == snap.enqueued)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 6
+    ioctl(fd, CHANGE_MAX_SEGMENT_SIZE_CTL, 512);
+    read_status(status, &snap);
+    printf("TEST 6: segment size limit updated - ");
+    if (snap.max_segment_size == 512)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+    ioctl(fd, CHANGE_MAX_SEGMENT_SIZE_CTL, MAX_SEGMENT_SIZE);
+
+    munmap((void*)status, getpagesize());
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+#include <sys/stat.h>
+#include "const.h"
+
+
+int main(int argc, char** argv) {
+    int written = 0;
+    long expired;
+    char buf[MAX_SEGMENT_SIZE];
+
+
+	if(argc != 3){
+		printf("You should pass MAJOR number and MINOR number as parameters\n");
+		return -1;
+	}
+
+	int major = atoi(argv[1]);
+	int minor = atoi(argv[2]);
+	dev_t device = makedev(major, minor);
+
+    char pathname[80];
+    sprintf(pathname,"/dev/mailslot%d", minor);
+
+	if( mknod(pathname, S_IFCHR|0666, device) == -1 ){
+		if(errno == EEXIST)
+			printf("Pathname '%s' already exists\n",pathname);
+
+        else {
+			printf("ERROR in the creation of the file %s: %s\n", pathname, strerror(errno));
+			return -1;
+        }
+    }
+
+	int fd = open(pathname, 0666);
+
+	if(fd == -1) {
+		printf("ERROR while opening the file %s: %s\n", pathname, strerror(errno));
+		return -1;
+    }
+
+    while(ioctl(fd, GET_FREESPACE_SIZE_CTL) < MAX_MAIL_SLOT_SIZE)
+       read(fd, buf, MAX_SEGMENT_SIZE);
+
+    // TEST 1
+    printf("TEST 1: TTL disabled by default - ");
+    if (ioctl(fd, GET_TTL_CTL) == 0)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    ioctl(fd, CHANGE_TTL_CTL, 100);
+
+    // TEST 2
+    printf("TEST 2: TTL changed - ");
+    if (ioctl(fd, GET_TTL_CTL) == 100)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    /* FILL THE MAILSLOT, THEN LET THE BACKLOG GO STALE */
+    ioctl(fd, CHANGE_WRITE_BLOCKING_MODE_CTL, NON_BLOCKING_MODE);
+    memset(buf, 's', MAX_SEGMENT_SIZE);
+    while (write(fd, buf, MAX_SEGMENT_SIZE) > 0)
+        written++;
+    expired = ioctl(fd, GET_EXPIRED_COUNT_CTL);
+    usleep(200000);
+
+    // TEST 3
+    memset(buf, 'f', MAX_SEGMENT_SIZE);
+    printf("TEST 3: write on a full mailslot reclaims the expired messages - ");
+    if (write(fd, buf, MAX_SEGMENT_SIZE) == MAX_SEGMENT_SIZE)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 4
+    printf("TEST 4: expired messages counted - ");
+    if (ioctl(fd, GET_EXPIRED_COUNT_CTL) - expired == written)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 5
+    memset(buf, 0, MAX_SEGMENT_SIZE);
+    printf("TEST 5: fresh message read first - ");
+    if (read(fd, buf, MAX_SEGMENT_SIZE) == MAX_SEGMENT_SIZE && buf[0] == 'f')
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 6
+    write(fd, buf, 10);
+    usleep(200000);
+    ioctl(fd, CHANGE_READ_BLOCKING_MODE_CTL, NON_BLOCKING_MODE);
+    printf("TEST 6: expired message never read - ");
+    if (read(fd, buf, MAX_SEGMENT_SIZE) == -1 && errno == EAGAIN)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    ioctl(fd, CHANGE_TTL_CTL, 0);
+    ioctl(fd, CHANGE_WRITE_BLOCKING_MODE_CTL, BLOCKING_MODE);
+    ioctl(fd, CHANGE_READ_BLOCKING_MODE_CTL, BLOCKING_MODE);
+    close(fd);
+    return 0;
+}
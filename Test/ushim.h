@@ -0,0 +1,199 @@
+#ifndef USHIM_HEADER
+#define USHIM_HEADER
+
+/*
+ * User-space stand-ins for the kernel primitives used by mailslot_core.c, so that the queue core
+ * can be built into pthread programs and profiled with perf or valgrind without loading the module.
+ *   mutex, spinlock   -> pthread mutex
+ *   task, wakeup      -> per-thread mutex/condvar with a wakeup flag, same semantics as
+ *                        wake_up_process() on a task sleeping in wait_event_interruptible()
+ *   kmalloc, pages    -> malloc, aligned_alloc
+ *   atomic_t          -> gcc __atomic builtins
+ *   topology          -> getcpu(), packages of two CPUs
+ * Signals do not exist here: interruptible waits never fail.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <malloc.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#define ERESTARTSYS 512
+
+#ifdef USHIM_VERBOSE
+#define printk(...) fprintf(stderr, __VA_ARGS__)
+#else
+#define printk(...) do { } while (0)
+#endif
+#define KERN_INFO ""
+#define KERN_ERR ""
+
+#define PAGE_SIZE 4096UL
+#define ALIGN(x, a) (((x) + (a) - 1) & ~((__typeof__(x))(a) - 1))
+#define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+#define min_t(type, x, y) ((type)(x) < (type)(y) ? (type)(x) : (type)(y))
+
+// allocation
+
+typedef unsigned int gfp_t;
+#define GFP_KERNEL 0
+#define GFP_ATOMIC 0
+
+static inline void* kmalloc(size_t size, gfp_t flags) { return malloc(size); }
+static inline void* kzalloc(size_t size, gfp_t flags) { return calloc(1, size); }
+static inline void kfree(const void* p) { free((void*)p); }
+static inline size_t ksize(const void* p) { return malloc_usable_size((void*)p); }
+static inline unsigned long __get_free_page(gfp_t flags) { return (unsigned long)aligned_alloc(PAGE_SIZE, PAGE_SIZE); }
+static inline void free_page(unsigned long addr) { free((void*)addr); }
+static inline unsigned long get_zeroed_page(gfp_t flags) {
+    void* page = aligned_alloc(PAGE_SIZE, PAGE_SIZE);
+
+    if (page != NULL)
+        memset(page, 0, PAGE_SIZE);
+    return (unsigned long)page;
+}
+
+// atomics
+
+typedef struct { int counter; } atomic_t;
+
+static inline int atomic_read(const atomic_t* v) { return __atomic_load_n(&v->counter, __ATOMIC_RELAXED); }
+static inline void atomic_set(atomic_t* v, int i) { __atomic_store_n(&v->counter, i, __ATOMIC_RELAXED); }
+static inline void atomic_add(int i, atomic_t* v) { __atomic_fetch_add(&v->counter, i, __ATOMIC_SEQ_CST); }
+static inline void atomic_sub(int i, atomic_t* v) { __atomic_fetch_sub(&v->counter, i, __ATOMIC_SEQ_CST); }
+static inline int atomic_inc_return(atomic_t* v) { return __atomic_add_fetch(&v->counter, 1, __ATOMIC_SEQ_CST); }
+static inline void atomic_inc(atomic_t* v) { __atomic_fetch_add(&v->counter, 1, __ATOMIC_SEQ_CST); }
+static inline int atomic_dec_and_test(atomic_t* v) { return __atomic_sub_fetch(&v->counter, 1, __ATOMIC_SEQ_CST) == 0; }
+static inline int atomic_add_return(int i, atomic_t* v) { return __atomic_add_fetch(&v->counter, i, __ATOMIC_SEQ_CST); }
+static inline int atomic_cmpxchg(atomic_t* v, int old, int new_value) {
+    __atomic_compare_exchange_n(&v->counter, &old, new_value, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return old;
+}
+
+#define smp_wmb() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define smp_rmb() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define smp_mb() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+// topology: CPUs 2n and 2n + 1 make a package, node 0 holds them all; a package mask is its first CPU
+
+static inline int raw_smp_processor_id(void) {
+    unsigned int cpu = 0;
+    syscall(SYS_getcpu, &cpu, NULL, NULL);
+    return cpu;
+}
+#define cpu_cache_mask(cpu) ((cpu) & ~1)
+#define cpumask_test_cpu(cpu, mask) (((cpu) & ~1) == (mask))
+#define cpu_to_node(cpu) 0
+
+// mutex
+
+struct mutex { pthread_mutex_t lock; };
+
+static inline void mutex_init(struct mutex* m) { pthread_mutex_init(&m->lock, NULL); }
+static inline void mutex_lock(struct mutex* m) { pthread_mutex_lock(&m->lock); }
+static inline int mutex_lock_interruptible(struct mutex* m) { return pthread_mutex_lock(&m->lock); }
+static inline int mutex_trylock(struct mutex* m) { return pthread_mutex_trylock(&m->lock) == 0; }
+static inline void mutex_unlock(struct mutex* m) { pthread_mutex_unlock(&m->lock); }
+
+typedef struct { pthread_mutex_t lock; } spinlock_t;
+
+static inline void spin_lock_init(spinlock_t* s) { pthread_mutex_init(&s->lock, NULL); }
+static inline void spin_lock(spinlock_t* s) { pthread_mutex_lock(&s->lock); }
+static inline void spin_unlock(spinlock_t* s) { pthread_mutex_unlock(&s->lock); }
+
+// tasks, sleep and wakeup
+
+struct task_struct {
+    int pid;
+    int woken;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+static __thread struct task_struct* ushim_task;
+
+// the task of a thread is created on first use and never freed
+static inline struct task_struct* ushim_current(void) {
+    if (ushim_task == NULL) {
+        ushim_task = calloc(1, sizeof(struct task_struct));
+        ushim_task->pid = syscall(SYS_gettid);
+        pthread_mutex_init(&ushim_task->lock, NULL);
+        pthread_cond_init(&ushim_task->cond, NULL);
+    }
+    return ushim_task;
+}
+#define current (ushim_current())
+
+static inline int wake_up_process(struct task_struct* task) {
+    pthread_mutex_lock(&task->lock);
+    task->woken = 1;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+    return 1;
+}
+
+// tasks are never freed here
+#define get_task_struct(task) ((void)(task))
+#define put_task_struct(task) ((void)(task))
+
+// returns once woken up, consuming the wakeup
+static inline void ushim_schedule(void) {
+    struct task_struct* task = current;
+
+    pthread_mutex_lock(&task->lock);
+    while (!task->woken)
+        pthread_cond_wait(&task->cond, &task->lock);
+    task->woken = 0;
+    pthread_mutex_unlock(&task->lock);
+}
+
+#define need_resched() 0
+#define num_online_cpus() ((int)sysconf(_SC_NPROCESSORS_ONLN))
+#define signal_pending(task) 0
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() __atomic_signal_fence(__ATOMIC_SEQ_CST)
+#endif
+
+#define ACCESS_ONCE(x) (*(volatile __typeof__(x)*)&(x))
+
+typedef int wait_queue_head_t;
+#define DECLARE_WAIT_QUEUE_HEAD(name) static wait_queue_head_t name __attribute__((unused))
+
+// a wakeup between the check of condition and the sleep is not lost: it stays pending in the task
+#define wait_event_interruptible(wq, condition) ({  \
+    while (!(condition))                            \
+        ushim_schedule();                           \
+    0;                                              \
+})
+
+// time
+
+typedef long long ktime_t;
+
+static inline ktime_t ktime_get(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+#define ktime_to_ns(kt) (kt)
+
+static inline int fls64(unsigned long long x) { return x ? 64 - __builtin_clzll(x) : 0; }
+
+// not available in user space
+
+struct eventfd_ctx;
+#define eventfd_signal(ctx, n) do { } while (0)
+
+struct llist_node { struct llist_node* next; };
+
+#endif
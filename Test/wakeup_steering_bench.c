@@ -0,0 +1,186 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+#include <sys/stat.h>
+#include "const.h"
+
+/*
+ * READERS reader threads, each pinned to a CPU and with its own file hinted with SET_READER_CPU_CTL, sleep on
+ * the mailslot; a writer pinned to CPU 0 sends a message every PAUSE us. Latency from the enqueue timestamp
+ * (READ_EXT_CTL) to the return of the read, with WAKEUP_FIFO and WAKEUP_CACHE. Only meaningful on machines
+ * with more than one package: with a single one every reader is as close as the others.
+ */
+
+#define MESSAGES 20000
+#define READERS 4
+#define PAUSE 20    // us
+#define POISON 'p'
+
+char pathname[80];
+int fd;
+int cpus;
+unsigned long long latency[MESSAGES];
+int taken;
+pthread_mutex_t taken_lock = PTHREAD_MUTEX_INITIALIZER;
+
+unsigned long long monotonic_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void pin(int cpu) {
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    sched_setaffinity(0, sizeof(set), &set);
+}
+
+void* writer(void* args) {
+    char msg[64];
+    unsigned long long deadline;
+    int i;
+
+    pin(0);
+    memset(msg, 'x', sizeof(msg));
+    for (i = 0; i < MESSAGES; i++) {
+        write(fd, msg, sizeof(msg));
+        deadline = monotonic_ns() + PAUSE * 1000ULL;
+        while (monotonic_ns() < deadline);
+    }
+
+    memset(msg, POISON, sizeof(msg));
+    for (i = 0; i < READERS; i++)
+        write(fd, msg, sizeof(msg));
+    return NULL;
+}
+
+void* reader(void* args) {
+    int cpu = (int)(long)args % cpus;
+    char buf[MAX_SEGMENT_SIZE];
+    read_ext ext;
+    int rfd;
+
+    pin(cpu);
+    rfd = open(pathname, 0666);
+    ioctl(rfd, SET_READER_CPU_CTL, cpu);
+
+    ext.buf = buf;
+    while (1) {
+        ext.len = MAX_SEGMENT_SIZE;
+        if (ioctl(rfd, READ_EXT_CTL, &ext) < 0)
+            continue;
+        if (buf[0] == POISON)
+            break;
+
+        pthread_mutex_lock(&taken_lock);
+        latency[taken++] = monotonic_ns() - ext.enqueue_time;
+        pthread_mutex_unlock(&taken_lock);
+    }
+
+    close(rfd);
+    return NULL;
+}
+
+int compare(const void* a, const void* b) {
+    unsigned long long x = *(unsigned long long*)a, y = *(unsigned long long*)b;
+    return (x > y) - (x < y);
+}
+
+void run(int policy) {
+    pthread_t readers[READERS], tid;
+    int i;
+
+    ioctl(fd, CHANGE_WAKEUP_POLICY_CTL, policy);
+    taken = 0;
+
+    for (i = 0; i < READERS; i++)
+        pthread_create(&readers[i], NULL, reader, (void*)(long)i);
+    pthread_create(&tid, NULL, writer, NULL);
+
+    pthread_join(tid, NULL);
+    for (i = 0; i < READERS; i++)
+        pthread_join(readers[i], NULL);
+
+    qsort(latency, taken, sizeof(unsigned long long), compare);
+    printf("%s: p50 %8llu ns, p99 %8llu ns, p999 %8llu ns\n", policy == WAKEUP_FIFO ? "fifo " : "cache",
+            latency[taken / 2], latency[taken * 99 / 100], latency[taken * 999 / 1000]);
+}
+
+int main(int argc, char** argv) {
+    char read_buf[MAX_SEGMENT_SIZE];
+
+
+	if(argc != 3){
+		printf("You should pass MAJOR number and MINOR number as parameters\n");
+		return -1;
+	}
+
+	int major = atoi(argv[1]);
+	int minor = atoi(argv[2]);
+	dev_t device = makedev(major, minor);
+
+    sprintf(pathname,"/dev/mailslot%d", minor);
+
+	if( mknod(pathname, S_IFCHR|0666, device) == -1 ){
+		if(errno == EEXIST)
+			printf("Pathname '%s' already exists\n",pathname);
+
+        else {
+			printf("ERROR in the creation of the file %s: %s\n", pathname, strerror(errno));
+			return -1;
+        }
+    }
+
+	fd = open(pathname, 0666);
+
+	if(fd == -1) {
+		printf("ERROR while opening the file %s: %s\n", pathname, strerror(errno));
+		return -1;
+    }
+
+    while(ioctl(fd, GET_FREESPACE_SIZE_CTL) < MAX_MAIL_SLOT_SIZE)
+       read(fd, read_buf, MAX_SEGMENT_SIZE);
+
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    // TEST 1
+    printf("TEST 1: unknown wakeup policy refused - ");
+    if (ioctl(fd, CHANGE_WAKEUP_POLICY_CTL, 2) == -1 && errno == EINVAL)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 2
+    ioctl(fd, CHANGE_WAKEUP_POLICY_CTL, WAKEUP_CACHE);
+    printf("TEST 2: wakeup policy changed - ");
+    if (ioctl(fd, GET_WAKEUP_POLICY_CTL) == WAKEUP_CACHE)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 3
+    printf("TEST 3: reader CPU out of range refused, -1 accepted - ");
+    if (ioctl(fd, SET_READER_CPU_CTL, 1 << 20) == -1 && errno == EINVAL && ioctl(fd, SET_READER_CPU_CTL, -1) == 0)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    run(WAKEUP_FIFO);
+    run(WAKEUP_CACHE);
+
+    ioctl(fd, CHANGE_WAKEUP_POLICY_CTL, WAKEUP_FIFO);
+    close(fd);
+    return 0;
+}
@@ -7,33 +7,208 @@
 #include <linux/sched.h>
 #include <linux/slab.h>     /* For kmalloc, kfree */
 #include <linux/mutex.h>
-#include <linux/wait.h>     /* For wait_queue */
+#include <linux/atomic.h>
+#include <linux/llist.h>
+#include <linux/workqueue.h>
+#include <linux/eventfd.h>
+#include <linux/lz4.h>
+#include <linux/percpu.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>       /* For remap_pfn_range */
+#include <linux/shrinker.h>
 #include "linux_mail_slot.h"
+#include "mailslot_kapi.h"
+#include "mailslot_core.c"    /* queue, accounting and sleeplists, also built in user space by Test/ */
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Andrea Migliori");
 MODULE_DESCRIPTION("This module implements a device file driver for Linux FIFO mailslot");
 
-static segment* mailslots[MAX_MINOR_NUM];
-static elem head = {NULL, -1, NULL, NULL};
-static elem tail = {NULL, -1, NULL, NULL};
-static list writers_list[MAX_MINOR_NUM];
-static list readers_list[MAX_MINOR_NUM];
-
 static int major;
 static int current_max_segment_size[MAX_MINOR_NUM];
-static int used_space[MAX_MINOR_NUM];
-static struct mutex mutex[MAX_MINOR_NUM];
 static int read_blk_mode[MAX_MINOR_NUM];
 static int write_blk_mode[MAX_MINOR_NUM];
 
-DECLARE_WAIT_QUEUE_HEAD(writers_queue);
-DECLARE_WAIT_QUEUE_HEAD(readers_queue);
+// segments enqueued from atomic context, linked to the mailslot by kenqueue_work
+static struct llist_head kenqueue_pending[MAX_MINOR_NUM];
+static struct work_struct kenqueue_work[MAX_MINOR_NUM];
+
+// LZ4 compression of payloads, see CHANGE_COMPRESSION_MODE_CTL
+static int compress_mode[MAX_MINOR_NUM];
+static DEFINE_PER_CPU(void*, lz4_wrkmem);
+static DEFINE_PER_CPU(void*, lz4_dst);    // lz4_compressbound(MAX_SEGMENT_SIZE) bytes
+
+// longest time a write staged by a corked file waits to be committed, see CHANGE_CORK_DELAY_CTL
+static unsigned int cork_delay[MAX_MINOR_NUM];
 
 //----------------------------------------------------------------------
 
+// Replaces the payload of new_msg (len bytes) with its LZ4 compression, unless that does not save space.
+// Called out of critical section, before the space is reserved, so that the mailslot accounts compressed bytes.
+static void compress_segment(segment* new_msg, size_t len) {
+    size_t compressed_len = lz4_compressbound(len);
+    char* compressed = NULL;
+    int cpu;
+
+    // per-cpu scratch buffers, preemption disabled while they are in use
+    cpu = get_cpu();
+    if (lz4_compress((unsigned char*)new_msg->payload, len, per_cpu(lz4_dst, cpu), &compressed_len, per_cpu(lz4_wrkmem, cpu)) == 0 &&
+            compressed_len < len) {
+        compressed = kmalloc(compressed_len, GFP_ATOMIC);
+        if (compressed != NULL)
+            memcpy(compressed, per_cpu(lz4_dst, cpu), compressed_len);
+    }
+    put_cpu();
+
+    if (compressed == NULL)
+        return;
+
+    kfree(new_msg->payload);
+    new_msg->payload = compressed;
+    new_msg->size = compressed_len;
+    new_msg->compressed = 1;
+}
+
+// copies the message of a detached single segment (orig_size bytes) in dst, decompressing it if needed
+static int copy_payload(segment* msg, char* dst) {
+    size_t out_len = msg->orig_size;
+
+    if (msg->pages != NULL) {
+        copy_from_pages(msg, dst, msg->size);
+        return 0;
+    }
+
+    if (!msg->compressed) {
+        memcpy(dst, msg->payload, msg->size);
+        return 0;
+    }
+
+    if (lz4_decompress_unknownoutputsize((unsigned char*)msg->payload, msg->size, (unsigned char*)dst, &out_len) < 0 || out_len != msg->orig_size) {
+        printk(KERN_ERR "%s: ERROR - corrupted compressed segment\n", MODNAME);
+        return -EIO;
+    }
+    return 0;
+}
+
+static int copy_message(message* msg, char* dst) {
+    if (msg->seg == NULL) {
+        memcpy(dst, msg->packed_payload, msg->size);
+        return 0;
+    }
+    return copy_payload(msg->seg, dst);
+}
+
+// user space counterparts of copy_to_segment() and copy_from_pages(), a page at a time
+static int copy_segment_from_user(segment* msg, const char* buff, size_t len) {
+    int i;
+
+    if (msg->pages == NULL)
+        return copy_from_user(msg->payload, buff, len) ? -EFAULT : 0;
+
+    for (i = 0; i < msg->nr_pages; i++)
+        if (copy_from_user(msg->pages[i], buff + i * PAGE_SIZE, min_t(size_t, PAGE_SIZE, len - i * PAGE_SIZE)))
+            return -EFAULT;
+    return 0;
+}
+
+static int copy_pages_to_user(segment* msg, char* buff, size_t len) {
+    int i;
+
+    for (i = 0; i < msg->nr_pages; i++)
+        if (copy_to_user(buff + i * PAGE_SIZE, msg->pages[i], min_t(size_t, PAGE_SIZE, len - i * PAGE_SIZE)))
+            return -EFAULT;
+    return 0;
+}
+
+//----------------------------------------------------------------------
+// Cork mode: a corked file stages small writes in a batch (see stage_record()), committed to the mailslot in
+// a single enqueue_segment() on uncork, when the batch is full or cork_delay after its first write. Messages
+// keep their boundaries and the order of the file, and no other message gets in between them; a write that
+// is not staged commits the batch before it.
+
+// Commits the staged batch of file, with cork_lock held. It is kept if the mailslot cannot take it now.
+static ssize_t flush_staged(mailslot_file* file, int blk_mode) {
+    ssize_t res;
+
+    if (file->staged.records == 0)
+        return 0;
+
+    res = enqueue_segment(file->minor, &file->staged, file->staged.size, blk_mode);
+    if (res == -EAGAIN || res == -ERESTARTSYS)
+        return res;
+
+    clear_batch(&file->staged);
+    return res;
+}
+
+// Commits the batch of a corked file cork_delay after its first write, retrying later if the mailslot is busy.
+// A writer may hold cork_lock across a blocking commit: rather than pinning a worker of system_wq on it, the
+// work tries again at the next tick.
+static void cork_work_fn(struct work_struct* work) {
+    mailslot_file* file = container_of(to_delayed_work(work), mailslot_file, cork_work);
+
+    if (!mutex_trylock(&file->cork_lock)) {
+        schedule_delayed_work(&file->cork_work, 1);
+        return;
+    }
+    if (flush_staged(file, NON_BLOCKING_MODE) == -EAGAIN)
+        schedule_delayed_work(&file->cork_work, usecs_to_jiffies(cork_delay[file->minor]));
+    mutex_unlock(&file->cork_lock);
+}
+
+// Stages a write of len bytes if the file is corked and the message small enough, committing the batch first
+// if it is full. Otherwise commits what is staged, so that the write goes after it, and returns 0.
+static ssize_t write_corked(int current_minor, mailslot_file* file, const char* buff, size_t len, unsigned long long call_id) {
+    char payload[PACKED_MAX_SIZE];
+    unsigned int key = partition_mode[current_minor] == PARTITION_ON ? file->key : 0;
+    ssize_t res;
+
+    mutex_lock(&file->cork_lock);
+    if (!file->corked || call_id != 0 || len > PACKED_MAX_SIZE) {
+        res = flush_staged(file, write_blk_mode[current_minor]);
+        mutex_unlock(&file->cork_lock);
+        return res < 0 ? res : 0;
+    }
+
+    if (copy_from_user(payload, buff, len)) {
+        printk(KERN_ERR "%s: ERROR in copy_from_user()\n", MODNAME);
+        mutex_unlock(&file->cork_lock);
+        return -EFAULT;
+    }
+
+    if (!stage_record(&file->staged, payload, len, key)) {
+        res = flush_staged(file, write_blk_mode[current_minor]);
+        if (res < 0) {
+            mutex_unlock(&file->cork_lock);
+            return res;
+        }
+        stage_record(&file->staged, payload, len, key);
+    }
+
+    if (file->staged.records == 1)
+        schedule_delayed_work(&file->cork_work, usecs_to_jiffies(cork_delay[current_minor]));
+    mutex_unlock(&file->cork_lock);
+
+    return len;
+}
+
+//----------------------------------------------------------------------
+
+// Adds the reader of file to the partition readers of the minor, if not done yet. A file opened read-only is
+// registered on open; one opened for reading and writing only on its first read, so that writers opening the
+// device O_RDWR do not own partitions whose messages they never read.
+static void register_file(int current_minor, mailslot_file* file) {
+    mutex_lock(&mutex[current_minor]);
+    if (!file->registered) {
+        register_reader(current_minor, &file->reader);
+        file->registered = 1;
+    }
+    mutex_unlock(&mutex[current_minor]);
+}
+
 static int mailslot_open(struct inode *inode, struct file *filp) {
     int current_minor = CURRENT_DEVICE;
+    mailslot_file* file;
 
     printk(KERN_INFO "%s: OPEN operation called on device file with minor number %d\n", MODNAME, current_minor);
 
@@ -41,6 +216,22 @@ static int mailslot_open(struct inode *inode, struct file *filp) {
         printk(KERN_ERR "%s: ERROR - device file with invalid minor number (%d). Minor should be in range [0-255]\n", MODNAME, current_minor);
         return -1;
     }
+
+    file = kzalloc(sizeof(mailslot_file), GFP_KERNEL);
+    if (file == NULL)
+        return -ENOMEM;
+
+    file->reader.cpu_hint = -1;
+    file->minor = current_minor;
+    file->staged.batch = 1;
+    mutex_init(&file->cork_lock);
+    INIT_DELAYED_WORK(&file->cork_work, cork_work_fn);
+
+    // readers take part in the partitions of the minor, rebalanced on every registration and release
+    if ((filp->f_mode & FMODE_READ) && !(filp->f_mode & FMODE_WRITE))
+        register_file(current_minor, file);
+    filp->private_data = file;
+
     return 0;
 }
 
@@ -48,27 +239,74 @@ static int mailslot_open(struct inode *inode, struct file *filp) {
 
 static int mailslot_release(struct inode *inode, struct file *filp) {
     int current_minor = CURRENT_DEVICE;
+    mailslot_file* file = filp->private_data;
 
     printk(KERN_INFO "%s: CLOSE operation called on device file with minor number %d\n", MODNAME, current_minor);
+
+    if (file->registered) {
+        mutex_lock(&mutex[current_minor]);
+        unregister_reader(current_minor, &file->reader);
+        mutex_unlock(&mutex[current_minor]);
+    }
+
+    // writes still staged are committed as on uncork
+    if (file->staged.payload != NULL) {
+        cancel_delayed_work_sync(&file->cork_work);
+        if (flush_staged(file, write_blk_mode[current_minor]) < 0)
+            printk(KERN_ERR "%s: ERROR - %d staged messages dropped at close\n", MODNAME, file->staged.records);
+        kfree(file->staged.payload);
+    }
+    kfree(file);
+
     return 0;
 }
 
 //----------------------------------------------------------------------
 
-static ssize_t mailslot_read(struct file * filp, char * buff, size_t len, loff_t * off) {
-    int res, current_minor = CURRENT_DEVICE;
-    elem me;
-    segment* msg_to_delete;
-    segment* tmp;
+// Moves a dequeued message to the user space buffer with copy_to_user (out of critical section) and releases it
+static ssize_t deliver_message(message* msg, char* buff) {
+    ssize_t res = msg->size;
     char* kernel_buffer;
-    elem* aux;
 
-    printk(KERN_INFO "%s: READ operation called on device file with minor number %d\n", MODNAME, current_minor);
+    // large segments go page by page, without a contiguous copy
+    if (msg->seg != NULL && msg->seg->pages != NULL) {
+        if (copy_pages_to_user(msg->seg, buff, res) < 0) {
+            printk(KERN_ERR "%s: ERROR in copy_to_user()\n", MODNAME);
+            res = -EFAULT;
+        }
+        release_message(msg);
+        return res;
+    }
+
+    kernel_buffer = message_data(msg);
+    if (kernel_buffer == NULL) {
+        kernel_buffer = kmalloc(res, GFP_KERNEL);
+        if (kernel_buffer == NULL || copy_message(msg, kernel_buffer) < 0) {
+            kfree(kernel_buffer);
+            release_message(msg);
+            return -EIO;
+        }
+    }
+
+    if (copy_to_user(buff, kernel_buffer, res)) {
+        printk(KERN_ERR "%s: ERROR in copy_to_user()\n", MODNAME);
+        res = -EFAULT;
+    }
+
+    if (kernel_buffer != message_data(msg))
+        kfree(kernel_buffer);
+    release_message(msg);
+
+    return res;
+}
 
-    me.task = current;
-    me.pid = current->pid;
-    me.next = NULL;
-    me.prev = NULL;
+static ssize_t mailslot_read(struct file * filp, char * buff, size_t len, loff_t * off) {
+    int current_minor = CURRENT_DEVICE;
+    mailslot_file* file = filp->private_data;
+    ssize_t res;
+    message msg;
+
+    printk(KERN_INFO "%s: READ operation called on device file with minor number %d\n", MODNAME, current_minor);
 
     // preliminary checks
     if (len == 0) {
@@ -76,305 +314,435 @@ static ssize_t mailslot_read(struct file * filp, char * buff, size_t len, loff_t
         return -EMSGSIZE;
     }
 
-    if(len > MAX_SEGMENT_SIZE)
-        len = MAX_SEGMENT_SIZE;
+    if(len > MAX_MESSAGE_SIZE)
+        len = MAX_MESSAGE_SIZE;
 
-    // allocating buffer in kernel space so as to move data in critical section without the possibility of going to sleep
-    kernel_buffer = kmalloc(len, GFP_KERNEL);
-    memset(kernel_buffer, 0, len);
+    if (!ACCESS_ONCE(file->registered))
+        register_file(current_minor, file);
 
-    // entering in critical section
-    if (read_blk_mode[current_minor] == BLOCKING_MODE) {
-        if (mutex_lock_interruptible(&mutex[current_minor])) {
-            printk(KERN_ERR "%s: ERROR - process %d has been woken up by a signal\n", MODNAME, current->pid);
-            return -ERESTARTSYS;
-        }
+    res = dequeue_segment(current_minor, &file->reader, len, read_blk_mode[current_minor], &msg);
+    if (res < 0)
+        return res;
+
+    return deliver_message(&msg, buff);
+}
+
+// read() that also returns the sequence number and the timestamps of the message, see READ_EXT_CTL
+static ssize_t mailslot_read_ext(int current_minor, mailslot_file* file, read_ext* ext) {
+    ssize_t res;
+    message msg;
+    size_t len = ext->len;
+
+    if (ext->len <= 0) {
+        printk(KERN_ERR "%s: ERROR - message not read because input length is 0\n", MODNAME);
+        return -EMSGSIZE;
+    }
+
+    if(len > MAX_MESSAGE_SIZE)
+        len = MAX_MESSAGE_SIZE;
+
+    if (!ACCESS_ONCE(file->registered))
+        register_file(current_minor, file);
+
+    res = dequeue_segment(current_minor, &file->reader, len, read_blk_mode[current_minor], &msg);
+    if (res < 0)
+        return res;
+
+    ext->seq = msg.meta.seq;
+    ext->enqueue_time = msg.meta.enqueue_time;
+    ext->dequeue_time = msg.dequeue_time;
+    ext->call_id = msg.meta.call_id;
+
+    return deliver_message(&msg, ext->buf);
+}
+
+//----------------------------------------------------------------------
+
+// Enqueues len bytes of the user buffer buff, shared by write() and by the requests of CALL_CTL
+static ssize_t write_message(int current_minor, mailslot_file* file, const char *buff, size_t len, unsigned long long call_id) {
+    ssize_t res;
+    segment* new_msg;
+    segment small_msg;
+    char small_payload[PACKED_MAX_SIZE];
+
+    // preliminary check before allocation
+    if (len > current_max_segment_size[current_minor] || len == 0) {
+        printk(KERN_ERR "%s: ERROR - message not written because too large or empty. Message size = %zu, Maximum segment size = %d\n",
+                    MODNAME, len, current_max_segment_size[current_minor]);
+        return -EMSGSIZE;
+    }
+
+    if (file->staged.payload != NULL) {
+        res = write_corked(current_minor, file, buff, len, call_id);
+        if (res != 0)
+            return res;
+    }
+
+    // small messages are packed in a chunk by enqueue_segment(), no allocation needed
+    if (len <= PACKED_MAX_SIZE) {
+        new_msg = &small_msg;
+        memset(new_msg, 0, sizeof(segment));
+        new_msg->payload = small_payload;
     }
 
+    // allocating segment out of critical section (possibility of going to sleep)
     else {
-        if (!mutex_trylock(&mutex[current_minor])) {
-            printk(KERN_ERR "%s: ERROR - non-blocking read operation and resource not available\n", MODNAME);
-            kfree(kernel_buffer);
-            return -EAGAIN;
-        }
+        new_msg = alloc_segment(&pools[current_minor], len, GFP_KERNEL);
+        if (new_msg == NULL)
+            return -ENOMEM;
     }
 
-    // there is nothing to read
-    while(mailslots[current_minor] == NULL) {
+    if (copy_segment_from_user(new_msg, buff, len) < 0) {
+        printk(KERN_ERR "%s: ERROR in copy_from_user()\n", MODNAME);
+        if (new_msg != &small_msg)
+            free_segment(new_msg);
+        return -EFAULT;
+    }
 
-        printk(KERN_INFO "%s: mailslot is empty, nothing to read\n", MODNAME);
+    new_msg->size = len;
+    new_msg->orig_size = len;
+    new_msg->meta.call_id = call_id;
+    if (partition_mode[current_minor] == PARTITION_ON)
+        new_msg->meta.key = file->key;
+    // packed messages are left uncompressed: LZ4 rarely shrinks 256 bytes, and packing already spares them
+    // a segment of their own
+    if (compress_mode[current_minor] == COMPRESSION_ON && new_msg != &small_msg && new_msg->pages == NULL)
+        compress_segment(new_msg, len);
+
+    res = enqueue_segment(current_minor, new_msg, len, write_blk_mode[current_minor]);
+    if (res < 0 && new_msg != &small_msg)
+        free_segment(new_msg);
+
+    return res;
+}
 
-        // if non-blocking, return (all or nothing)
-        if (read_blk_mode[current_minor] == NON_BLOCKING_MODE) {
-            printk(KERN_ERR "%s: ERROR - non-blocking read operation and nothing to read\n", MODNAME);
-            kfree(kernel_buffer);
-            mutex_unlock(&mutex[current_minor]);
-            return -EAGAIN;
-        }
+static ssize_t mailslot_write(struct file *filp, const char *buff, size_t len, loff_t *off) {
+    int current_minor = CURRENT_DEVICE;
 
-        // put the task in readers_list
-        aux = &(readers_list[current_minor].tail);
-        if (aux->prev == NULL) {
-            printk(KERN_ERR "%s: ERROR - malformed readers sleeplist, service damaged!\n", MODNAME);
-            kfree(kernel_buffer);
-            mutex_unlock(&mutex[current_minor]);
-            return -1;
+    printk(KERN_INFO "%s: WRITE operation called on device file with minor number %d\n", MODNAME, current_minor);
+
+    return write_message(current_minor, filp->private_data, buff, len, 0);
+}
+
+//----------------------------------------------------------------------
+
+static struct file_operations fops;
+
+// Writes the same message to the minor of every file of mc, see MULTICAST_CTL. The payload is copied from user
+// space once: small messages are packed in each minor, the others share a refcounted payload (see
+// share_segment()), freed with the last segment using it. A target must be a mailslot file open for writing,
+// so that nobody writes to a minor whose node does not let them; each one is written as write() on it would,
+// with its own partition key and the blocking mode of its minor.
+static int mailslot_multicast(mailslot_file* file, multicast* mc) {
+    struct file* targets[MAX_MULTICAST];
+    mailslot_file* target;
+    segment* owner = NULL;
+    segment* new_msg;
+    segment small_msg;
+    char small_payload[PACKED_MAX_SIZE];
+    int i, minor, delivered = 0;
+
+    if (mc->nr_fds <= 0 || mc->nr_fds > MAX_MULTICAST) {
+        printk(KERN_ERR "%s: ERROR - multicast to %d files, up to %d allowed\n", MODNAME, mc->nr_fds, MAX_MULTICAST);
+        return -EINVAL;
+    }
+
+    if (mc->len <= 0 || mc->len > MAX_MESSAGE_SIZE) {
+        printk(KERN_ERR "%s: ERROR - multicast not written because too large or empty. Message size = %d\n", MODNAME, mc->len);
+        return -EMSGSIZE;
+    }
+
+    if (mc->len <= PACKED_MAX_SIZE) {
+        if (copy_from_user(small_payload, mc->buf, mc->len)) {
+            printk(KERN_ERR "%s: ERROR in copy_from_user()\n", MODNAME);
+            return -EFAULT;
         }
-        aux->prev->next = &me;
-        me.prev = aux->prev;
-        me.next = aux;
-        aux->prev = &me;
+    }
 
-        mutex_unlock(&mutex[current_minor]);
+    else {
+        owner = alloc_segment(&pools[file->minor], mc->len, GFP_KERNEL);
+        if (owner == NULL)
+            return -ENOMEM;
+        if (copy_segment_from_user(owner, mc->buf, mc->len) < 0) {
+            printk(KERN_ERR "%s: ERROR in copy_from_user()\n", MODNAME);
+            free_segment(owner);
+            return -EFAULT;
+        }
+        owner->size = mc->len;
+        owner->orig_size = mc->len;
+        atomic_set(&owner->refs, 1);
+    }
 
-        printk(KERN_INFO "%s: process %d goes to sleep\n", MODNAME, current->pid);
+    // messages of this file staged on its own minor go first
+    if (file->staged.payload != NULL) {
+        mutex_lock(&file->cork_lock);
+        flush_staged(file, write_blk_mode[file->minor]);
+        mutex_unlock(&file->cork_lock);
+    }
 
-        // going to sleep out of critical section
-        res = wait_event_interruptible(readers_queue, mailslots[current_minor] != NULL);
-        if (res != 0) {
-            printk(KERN_ERR "%s: ERROR - process %d has been woken up by a signal\n", MODNAME, current->pid);
-            return -ERESTARTSYS;
+    for (i = 0; i < mc->nr_fds; i++) {
+        targets[i] = fget(mc->fds[i]);
+        if (targets[i] == NULL || targets[i]->f_op != &fops || !(targets[i]->f_mode & FMODE_WRITE)) {
+            printk(KERN_ERR "%s: ERROR - multicast target %d is not a mailslot open for writing\n", MODNAME, mc->fds[i]);
+            mc->results[i] = -EBADF;
+            continue;
         }
+        target = targets[i]->private_data;
+        minor = target->minor;
 
-        // woken up, removing the task from the list (critical section)
-        if (read_blk_mode[current_minor] == BLOCKING_MODE) {
-            if (mutex_lock_interruptible(&mutex[current_minor])) {
-                printk(KERN_ERR "%s: ERROR - process %d has been woken up by a signal\n", MODNAME, current->pid);
-                return -ERESTARTSYS;
-            }
+        if (mc->len > current_max_segment_size[minor]) {
+            mc->results[i] = -EMSGSIZE;
+            continue;
         }
 
+        if (owner == NULL) {
+            new_msg = &small_msg;
+            memset(new_msg, 0, sizeof(segment));
+            new_msg->payload = small_payload;
+            new_msg->size = mc->len;
+            new_msg->orig_size = mc->len;
+        }
         else {
-            if (!mutex_trylock(&mutex[current_minor])) {
-                printk(KERN_ERR "%s: ERROR - non-blocking read operation and resource not available\n", MODNAME);
-                kfree(kernel_buffer);
-                return -EAGAIN;
+            new_msg = share_segment(owner, GFP_KERNEL);
+            if (new_msg == NULL) {
+                mc->results[i] = -ENOMEM;
+                continue;
             }
         }
+        if (partition_mode[minor] == PARTITION_ON)
+            new_msg->meta.key = target->key;
+
+        mc->results[i] = enqueue_segment(minor, new_msg, mc->len, write_blk_mode[minor]);
+        if (mc->results[i] >= 0)
+            delivered++;
+        else if (new_msg != &small_msg)
+            free_segment(new_msg);
+    }
 
-        aux = &(readers_list[current_minor].head);
-        if (aux == NULL) {
-            printk(KERN_ERR "%s: ERROR - malformed readers sleeplist upon wakeup, service damaged!\n", MODNAME);
-            kfree(kernel_buffer);
-            mutex_unlock(&mutex[current_minor]);
-            return -1;
-        }
-        me.prev->next = me.next;
-        me.next->prev = me.prev;
+    for (i = 0; i < mc->nr_fds; i++)
+        if (targets[i] != NULL)
+            fput(targets[i]);
 
-        printk(KERN_INFO "%s: process %d has been woken up\n", MODNAME, current->pid);
-    }
+    if (owner != NULL)
+        put_shared(owner);
 
-    printk(KERN_INFO "%s : length to read = %zu and message size = %d\n", MODNAME, len, mailslots[current_minor]->size);
+    return delivered;
+}
 
-    // length to read < first segment size
-    if(len <  mailslots[current_minor]->size){
-        printk(KERN_ERR "%s: ERROR - trying to read an amount of data less than first segment size\n", MODNAME);
-        kfree(kernel_buffer);
-        mutex_unlock(&mutex[current_minor]);
-        return -EINVAL;
+//----------------------------------------------------------------------
+
+// Writes the request of a call on this minor and sleeps until its reply arrives on call->reply_minor, see CALL_CTL
+static ssize_t mailslot_call(int current_minor, mailslot_file* file, call_request* call) {
+    call_waiter waiter;
+    message msg;
+    ssize_t res;
+
+    if (call->reply_minor >= MAX_MINOR_NUM || call->reply_minor < 0) {
+        printk(KERN_ERR "%s: ERROR - invalid reply minor number (%d)\n", MODNAME, call->reply_minor);
+        return -ENODEV;
     }
 
-    len = mailslots[current_minor]->size;
-    memcpy(kernel_buffer, mailslots[current_minor]->payload, len);
-    used_space[current_minor] -= len;
+    if (call->reply_len <= 0) {
+        printk(KERN_ERR "%s: ERROR - call not sent because reply length is 0\n", MODNAME);
+        return -EMSGSIZE;
+    }
 
-    msg_to_delete = mailslots[current_minor];
-    mailslots[current_minor] = mailslots[current_minor]->next;
+    // the caller waits for the reply before the request can be read
+    register_call(call->reply_minor, &waiter, call->reply_len);
+    call->call_id = waiter.call_id;
 
-    // in case of malformed writers sleeplist, recover initial situation
-    aux = &(writers_list[current_minor].head);
-    if (aux == NULL) {
-        printk(KERN_ERR "%s: ERROR - malformed writers sleeplist, service damaged!\n", MODNAME);
-        kfree(kernel_buffer);
-        used_space[current_minor] += len;
-        tmp = mailslots[current_minor];
-        mailslots[current_minor] = msg_to_delete;
-        mailslots[current_minor]->next = tmp;
-        mutex_unlock(&mutex[current_minor]);
-        return -1;
+    res = write_message(current_minor, file, call->req, call->req_len, waiter.call_id);
+    if (res < 0) {
+        cancel_call(call->reply_minor, &waiter);
+        return res;
     }
 
-    // time to awake writers
-    while (aux->next != &(writers_list[current_minor].tail)) {
-        wake_up_process(aux->next->task);
-        aux = aux->next;
+    res = wait_reply(call->reply_minor, &waiter);
+    if (res < 0)
+        return res;
+
+    msg.size = res;
+    msg.seg = waiter.reply;
+    return deliver_message(&msg, call->reply);
+}
+
+// Hands a reply over to the caller waiting for it on this minor, see REPLY_CTL
+static int mailslot_reply(int current_minor, call_reply* reply) {
+    segment* new_msg;
+    int res;
+
+    if (reply->len > current_max_segment_size[current_minor] || reply->len <= 0) {
+        printk(KERN_ERR "%s: ERROR - reply not sent because too large or empty. Reply size = %d, Maximum segment size = %d\n",
+                    MODNAME, reply->len, current_max_segment_size[current_minor]);
+        return -EMSGSIZE;
     }
 
-    mutex_unlock(&mutex[current_minor]);
+    new_msg = alloc_segment(&pools[current_minor], reply->len, GFP_KERNEL);
+    if (new_msg == NULL)
+        return -ENOMEM;
 
-    // move data to user space buffer with copy_to_user (out of critical section)
-    if (copy_to_user(buff, kernel_buffer, len)) {
-        printk(KERN_ERR "%s: ERROR in copy_to_user()\n", MODNAME);
-        return -1;
+    if (copy_segment_from_user(new_msg, reply->buf, reply->len) < 0) {
+        printk(KERN_ERR "%s: ERROR in copy_from_user()\n", MODNAME);
+        free_segment(new_msg);
+        return -EFAULT;
     }
+    new_msg->size = reply->len;
+    new_msg->orig_size = reply->len;
 
-    kfree(kernel_buffer);
-    kfree(msg_to_delete->payload);
-    kfree(msg_to_delete);
+    res = deliver_reply(current_minor, reply->call_id, new_msg);
+    if (res < 0) {
+        printk(KERN_ERR "%s: ERROR - no caller waiting for a reply of %d bytes to call %llu\n", MODNAME, reply->len, reply->call_id);
+        free_segment(new_msg);
+    }
 
-    return len;
+    return res;
 }
 
 //----------------------------------------------------------------------
+// In-kernel producer/consumer API (see mailslot_kapi.h)
 
-static ssize_t mailslot_write(struct file *filp, const char *buff, size_t len, loff_t *off) {
-    int res, current_minor = CURRENT_DEVICE;
-    elem me;
-    segment* new_msg;
-    segment* tmp;
-    elem* aux;
+static inline int kapi_blk_mode(int flags) {
+    return (flags & MAILSLOT_KNONBLOCK) ? NON_BLOCKING_MODE : BLOCKING_MODE;
+}
 
-    printk(KERN_INFO "%s: WRITE operation called on device file with minor number %d\n", MODNAME, current_minor);
+ssize_t mailslot_kenqueue(int minor, const void* buf, size_t len, int flags) {
+    ssize_t res;
+    segment* new_msg;
+    segment small_msg;
+    char small_payload[PACKED_MAX_SIZE];
 
-    me.task = current;
-    me.pid = current->pid;
-    me.next = NULL;
-    me.prev = NULL;
+    if (minor >= MAX_MINOR_NUM || minor < 0)
+        return -ENODEV;
 
-    // preliminary check before allocation
-    if (len > current_max_segment_size[current_minor] || len == 0) {
-        printk(KERN_ERR "%s: ERROR - message not written because too large or empty. Message size = %zu, Maximum segment size = %d\n",
-                    MODNAME, len, current_max_segment_size[current_minor]);
+    if (len > current_max_segment_size[minor] || len == 0) {
+        printk(KERN_ERR "%s: ERROR - message not enqueued because too large or empty. Message size = %zu, Maximum segment size = %d\n",
+                    MODNAME, len, current_max_segment_size[minor]);
         return -EMSGSIZE;
     }
 
-    // allocating segment out of critical section (possibility of going to sleep)
-    new_msg = kmalloc(sizeof(segment), GFP_KERNEL);
-    memset(new_msg, 0, sizeof(segment));
-
-    new_msg->payload = kmalloc(len, GFP_KERNEL);
-    memset(new_msg->payload, 0, len);
-    if (copy_from_user(new_msg->payload, buff, len)) {
-        printk(KERN_ERR "%s: ERROR in copy_from_user()\n", MODNAME);
-        return -1;
-    }
-
-    if (write_blk_mode[current_minor] == BLOCKING_MODE) {
-        if (mutex_lock_interruptible(&mutex[current_minor])) {
-                printk(KERN_ERR "%s: ERROR - process %d has been woken up by a signal\n", MODNAME, current->pid);
-                return -ERESTARTSYS;
-        }
+    if (len <= PACKED_MAX_SIZE) {
+        new_msg = &small_msg;
+        memset(new_msg, 0, sizeof(segment));
+        new_msg->payload = small_payload;
     }
 
     else {
-        if (!mutex_trylock(&mutex[current_minor])) {
-            printk(KERN_ERR "%s: ERROR - non-blocking write operation and resource not available\n", MODNAME);
-            kfree(new_msg->payload);
-            kfree(new_msg);
-            return -EAGAIN;
-        }
+        new_msg = alloc_segment(&pools[minor], len, GFP_KERNEL);
+        if (new_msg == NULL)
+            return -ENOMEM;
     }
+    copy_to_segment(new_msg, buf, len);
 
-    // mailslot is full or free space is not enough
-    while( len > (MAX_MAIL_SLOT_SIZE-used_space[current_minor]) ) {
+    new_msg->size = len;
+    new_msg->orig_size = len;
+    if (compress_mode[minor] == COMPRESSION_ON && new_msg != &small_msg && new_msg->pages == NULL)
+        compress_segment(new_msg, len);
 
-        printk(KERN_INFO "%s: mailslot full or insufficient space\n", MODNAME);
+    res = enqueue_segment(minor, new_msg, len, kapi_blk_mode(flags));
+    if (res < 0 && new_msg != &small_msg)
+        free_segment(new_msg);
 
-        // if non-blocking, return (all or nothing)
-        if (write_blk_mode[current_minor] == NON_BLOCKING_MODE) {
-            printk(KERN_ERR "%s: ERROR - non-blocking write operation and insufficient space\n", MODNAME);
-            kfree(new_msg->payload);
-            kfree(new_msg);
-            mutex_unlock(&mutex[current_minor]);
-            return -EAGAIN;
-        }
-
-        // put the task in writers_list
-        aux = &(writers_list[current_minor].tail);
-        if (aux->prev == NULL) {
-            printk(KERN_ERR "%s: ERROR - malformed writers sleeplist, service damaged!\n", MODNAME);
-            kfree(new_msg->payload);
-            kfree(new_msg);
-            mutex_unlock(&mutex[current_minor]);
-            return -1;
-        }
-        aux->prev->next = &me;
-        me.prev = aux->prev;
-        me.next = aux;
-        aux->prev = &me;
+    return res;
+}
+EXPORT_SYMBOL(mailslot_kenqueue);
 
-        mutex_unlock(&mutex[current_minor]);
+ssize_t mailslot_kdequeue(int minor, void* buf, size_t len, int flags) {
+    ssize_t res;
+    message msg;
 
-        printk(KERN_INFO "%s: process %d goes to sleep\n", MODNAME, current->pid);
+    if (minor >= MAX_MINOR_NUM || minor < 0)
+        return -ENODEV;
 
-        // going to sleep out of critical section
-        res = wait_event_interruptible(writers_queue, len <= (MAX_MAIL_SLOT_SIZE-used_space[current_minor]));
-        if (res != 0) {
-            printk(KERN_ERR "%s: ERROR - process %d has been woken up by a signal\n", MODNAME, current->pid);
-            return -ERESTARTSYS;
-        }
+    if (len == 0)
+        return -EMSGSIZE;
 
-        // woken up, removing the task from the list (critical section)
-        if (write_blk_mode[current_minor] == BLOCKING_MODE) {
-            if (mutex_lock_interruptible(&mutex[current_minor])) {
-                printk(KERN_ERR "%s: ERROR - process %d has been woken up by a signal\n", MODNAME, current->pid);
-                return -ERESTARTSYS;
-            }
-        }
+    res = dequeue_segment(minor, NULL, len, kapi_blk_mode(flags), &msg);
+    if (res < 0)
+        return res;
 
-        else {
-            if (!mutex_trylock(&mutex[current_minor])) {
-                printk(KERN_ERR "%s: ERROR - non-blocking write operation and resource not available\n", MODNAME);
-                kfree(new_msg->payload);
-                kfree(new_msg);
-                return -EAGAIN;
-            }
-        }
+    if (copy_message(&msg, buf) < 0)
+        res = -EIO;
+    release_message(&msg);
 
-        aux = &(writers_list[current_minor].head);
-        if (aux == NULL) {
-            printk(KERN_ERR "%s: ERROR - malformed writers sleeplist upon wakeup, service damaged!\n", MODNAME);
-            kfree(new_msg->payload);
-            kfree(new_msg);
-            mutex_unlock(&mutex[current_minor]);
-            return -1;
-        }
+    return res;
+}
+EXPORT_SYMBOL(mailslot_kdequeue);
 
-        me.prev->next = me.next;
-        me.next->prev = me.prev;
+// Never sleeps: the space is reserved and the segment is stamped here, linking it to the mailslot
+// (which needs the locks) and waking up the readers is deferred to kenqueue_work.
+ssize_t mailslot_kenqueue_atomic(int minor, const void* buf, size_t len) {
+    segment* new_msg;
 
-        printk(KERN_INFO "%s: process %d has been woken up\n", MODNAME, current->pid);
-    }
+    if (minor >= MAX_MINOR_NUM || minor < 0)
+        return -ENODEV;
 
-    new_msg->size = len;
-    new_msg->next = NULL;
+    // large messages would need many atomic page allocations
+    if (len > current_max_segment_size[minor] || len > MAX_SEGMENT_SIZE || len == 0)
+        return -EMSGSIZE;
 
-    // add the segment to the mailslot and increment used space in the mailbox
-    if (mailslots[current_minor] == NULL)
-        mailslots[current_minor] = new_msg;
+    new_msg = kzalloc(sizeof(segment), GFP_ATOMIC);
+    if (new_msg == NULL)
+        return -ENOMEM;
 
-    else {
-        tmp = mailslots[current_minor];
-        while(tmp->next != NULL)
-            tmp = tmp->next;
-        tmp->next = new_msg;
+    new_msg->payload = kmalloc(len, GFP_ATOMIC);
+    if (new_msg->payload == NULL) {
+        kfree(new_msg);
+        return -ENOMEM;
     }
+    memcpy(new_msg->payload, buf, len);
 
-    used_space[current_minor] += len;
+    // neither compressed nor packed: linked as it is by kenqueue_work
+    new_msg->size = len;
+    new_msg->orig_size = len;
 
-    // time to awake one reader
-    aux = &(readers_list[current_minor].head);
-    if (aux == NULL) {
-        printk(KERN_ERR "%s: ERROR - malformed readers sleeplist, service damaged!\n", MODNAME);
-        kfree(new_msg->payload);
-        kfree(new_msg);
-        mutex_unlock(&mutex[current_minor]);
-        return -1;
+    if (!reserve_space(minor, len, segment_memory(new_msg))) {
+        free_segment(new_msg);
+        return -EAGAIN;
     }
 
-    if (aux->next != &(readers_list[current_minor].tail))
-        wake_up_process(aux->next->task);
+    new_msg->meta.enqueue_time = now_ns();
 
-    mutex_unlock(&mutex[current_minor]);
+    llist_add(&new_msg->lnode, &kenqueue_pending[minor]);
+    schedule_work(&kenqueue_work[minor]);
 
     return len;
 }
+EXPORT_SYMBOL(mailslot_kenqueue_atomic);
+
+static void kenqueue_work_fn(struct work_struct* work) {
+    int minor = work - kenqueue_work;
+    struct llist_node* node;
+    segment* first = NULL;
+    segment* msg;
+
+    // llist is LIFO: pushing each node in front of the chain restores arrival order
+    node = llist_del_all(&kenqueue_pending[minor]);
+    while (node != NULL) {
+        msg = llist_entry(node, segment, lnode);
+        node = node->next;
+        msg->next = first;
+        first = msg;
+    }
+
+    if (first != NULL)
+        enqueue_reserved(minor, first);
+}
 
 //----------------------------------------------------------------------
 
 static long mailslot_ctl(struct file *filp, unsigned int cmd, unsigned long arg) {
     int current_minor = CURRENT_DEVICE;
+    mailslot_file* file = filp->private_data;
+    latency_stats *snapshot;
+    eventfd_binding binding;
+    read_ext ext;
+    call_request call;
+    call_reply reply;
+    multicast mc;
+    pool_stats pstats;
+    ssize_t res;
+    int i, count;
+    struct eventfd_ctx *ctx = NULL;
 
 	printk(KERN_INFO "%s : IOCTL operation called on device file with minor number %d - cmd = %d, arg = %ld\n",
                 MODNAME, current_minor, cmd, arg);
@@ -404,11 +772,12 @@ static long mailslot_ctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		case CHANGE_MAX_SEGMENT_SIZE_CTL:
             printk(KERN_INFO "%s: changing maximum segment size for device file with minor number %d\n", MODNAME, current_minor);
 
-			if(arg < 1 || arg > MAX_SEGMENT_SIZE){
+			if(arg < 1 || arg > MAX_MESSAGE_SIZE){
                 printk(KERN_ERR "%s: ERROR - invalid argument for maximum segment size\n", MODNAME);
                 return -EINVAL;
             }
             current_max_segment_size[current_minor] = arg;
+            publish_max_segment_size(current_minor, arg);
 			break;
 
 		case GET_MAX_SEGMENT_SIZE_CTL:
@@ -417,7 +786,7 @@ static long mailslot_ctl(struct file *filp, unsigned int cmd, unsigned long arg)
 
 		case GET_FREESPACE_SIZE_CTL:
             printk(KERN_INFO "%s: getting free space size for device file with minor number %d\n", MODNAME, current_minor);
-            return MAX_MAIL_SLOT_SIZE - used_space[current_minor];
+            return MAX_MAIL_SLOT_SIZE - atomic_read(&used_space[current_minor]);
 
         case GET_WRITE_BLOCKING_MODE_CTL:
             printk(KERN_INFO "%s: getting write blocking mode for device file with minor number %d\n", MODNAME, current_minor);
@@ -427,6 +796,340 @@ static long mailslot_ctl(struct file *filp, unsigned int cmd, unsigned long arg)
             printk(KERN_INFO "%s: getting read blocking mode for device file with minor number %d\n", MODNAME, current_minor);
             return read_blk_mode[current_minor];
 
+        case GET_LATENCY_STATS_CTL:
+            printk(KERN_INFO "%s: getting latency histograms for device file with minor number %d\n", MODNAME, current_minor);
+
+            // snapshot taken with both locks held, copied to user space out of them
+            snapshot = kmalloc(sizeof(latency_stats), GFP_KERNEL);
+            if (snapshot == NULL)
+                return -ENOMEM;
+            mutex_lock(&mutex[current_minor]);
+            mutex_lock(&tail_mutex[current_minor]);
+            memcpy(snapshot, &latency[current_minor], sizeof(latency_stats));
+            mutex_unlock(&tail_mutex[current_minor]);
+            mutex_unlock(&mutex[current_minor]);
+
+            if (copy_to_user((void *)arg, snapshot, sizeof(latency_stats))) {
+                printk(KERN_ERR "%s: ERROR in copy_to_user()\n", MODNAME);
+                kfree(snapshot);
+                return -EFAULT;
+            }
+            kfree(snapshot);
+            break;
+
+        case GET_POOL_STATS_CTL:
+            printk(KERN_INFO "%s: getting pool statistics for device file with minor number %d\n", MODNAME, current_minor);
+
+            spin_lock(&pools[current_minor].lock);
+            pstats.hits = pools[current_minor].hits;
+            pstats.misses = pools[current_minor].misses;
+            pstats.trimmed = pools[current_minor].trimmed;
+            pstats.segments = pools[current_minor].nr_segments;
+            pstats.pages = pools[current_minor].nr_pages;
+            spin_unlock(&pools[current_minor].lock);
+
+            if (copy_to_user((void *)arg, &pstats, sizeof(pool_stats))) {
+                printk(KERN_ERR "%s: ERROR in copy_to_user()\n", MODNAME);
+                return -EFAULT;
+            }
+            break;
+
+        case RESET_LATENCY_STATS_CTL:
+            printk(KERN_INFO "%s: resetting latency histograms for device file with minor number %d\n", MODNAME, current_minor);
+
+            mutex_lock(&mutex[current_minor]);
+            mutex_lock(&tail_mutex[current_minor]);
+            memset(&latency[current_minor], 0, sizeof(latency_stats));
+            mutex_unlock(&tail_mutex[current_minor]);
+            mutex_unlock(&mutex[current_minor]);
+            break;
+
+        case CHANGE_COMPRESSION_MODE_CTL:
+            printk(KERN_INFO "%s: changing compression mode for device file with minor number %d\n", MODNAME, current_minor);
+
+            if (arg != COMPRESSION_OFF && arg != COMPRESSION_ON) {
+                printk(KERN_ERR "%s: ERROR - invalid argument for compression mode (0 or 1)\n", MODNAME);
+                return -EINVAL;
+            }
+            compress_mode[current_minor] = arg;
+            break;
+
+        case GET_COMPRESSION_MODE_CTL:
+            printk(KERN_INFO "%s: getting compression mode for device file with minor number %d\n", MODNAME, current_minor);
+            return compress_mode[current_minor];
+
+        case GET_USED_MEMORY_CTL:
+            printk(KERN_INFO "%s: getting used memory for device file with minor number %d\n", MODNAME, current_minor);
+            return atomic_read(&used_memory[current_minor]);
+
+        case BIND_EVENTFD_CTL:
+            printk(KERN_INFO "%s: binding eventfd to device file with minor number %d\n", MODNAME, current_minor);
+
+            if (copy_from_user(&binding, (void *)arg, sizeof(eventfd_binding))) {
+                printk(KERN_ERR "%s: ERROR in copy_from_user()\n", MODNAME);
+                return -EFAULT;
+            }
+
+            // a negative fd removes the current binding
+            if (binding.fd >= 0) {
+                if ((binding.events & ~(NOTIFY_NON_EMPTY | NOTIFY_DEPTH | NOTIFY_SPACE)) || binding.events == 0 ||
+                        ((binding.events & NOTIFY_DEPTH) && binding.depth < 1)) {
+                    printk(KERN_ERR "%s: ERROR - invalid argument for eventfd binding\n", MODNAME);
+                    return -EINVAL;
+                }
+
+                ctx = eventfd_ctx_fdget(binding.fd);
+                if (IS_ERR(ctx)) {
+                    printk(KERN_ERR "%s: ERROR - %d is not an eventfd\n", MODNAME, binding.fd);
+                    return PTR_ERR(ctx);
+                }
+            }
+
+            // swap with both locks held so that signalling, on either side, never sees a released context
+            mutex_lock(&mutex[current_minor]);
+            mutex_lock(&tail_mutex[current_minor]);
+            swap(ctx, notify_ctx[current_minor]);
+            notify_events[current_minor] = binding.events;
+            notify_depth[current_minor] = binding.depth;
+            mutex_unlock(&tail_mutex[current_minor]);
+            mutex_unlock(&mutex[current_minor]);
+
+            if (ctx != NULL)
+                eventfd_ctx_put(ctx);
+            break;
+
+        case CHANGE_TTL_CTL:
+            printk(KERN_INFO "%s: changing message TTL for device file with minor number %d\n", MODNAME, current_minor);
+
+            if (arg > INT_MAX) {
+                printk(KERN_ERR "%s: ERROR - invalid argument for TTL (ms, 0 to disable)\n", MODNAME);
+                return -EINVAL;
+            }
+
+            // it applies to the messages already queued as well
+            mutex_lock(&mutex[current_minor]);
+            ttl[current_minor] = arg * 1000000ULL;
+            drop_expired(current_minor);
+            mutex_unlock(&mutex[current_minor]);
+            break;
+
+        case GET_TTL_CTL:
+            printk(KERN_INFO "%s: getting message TTL for device file with minor number %d\n", MODNAME, current_minor);
+            return ttl[current_minor] / 1000000ULL;
+
+        case GET_EXPIRED_COUNT_CTL:
+            printk(KERN_INFO "%s: getting expired messages count for device file with minor number %d\n", MODNAME, current_minor);
+            return expired[current_minor];
+
+        case CHANGE_BUSY_POLL_CTL:
+            printk(KERN_INFO "%s: changing busy-poll budget for device file with minor number %d\n", MODNAME, current_minor);
+
+            if (arg > MAX_BUSY_POLL) {
+                printk(KERN_ERR "%s: ERROR - invalid argument for busy-poll budget (us, up to %d, 0 to disable)\n", MODNAME, MAX_BUSY_POLL);
+                return -EINVAL;
+            }
+
+            mutex_lock(&mutex[current_minor]);
+            busy_poll[current_minor] = arg * 1000ULL;
+            mutex_unlock(&mutex[current_minor]);
+            break;
+
+        case GET_BUSY_POLL_CTL:
+            printk(KERN_INFO "%s: getting busy-poll budget for device file with minor number %d\n", MODNAME, current_minor);
+            return busy_poll[current_minor] / 1000ULL;
+
+        case CHANGE_PARTITION_MODE_CTL:
+            printk(KERN_INFO "%s: changing partition mode for device file with minor number %d\n", MODNAME, current_minor);
+
+            if (arg != PARTITION_OFF && arg != PARTITION_ON) {
+                printk(KERN_ERR "%s: ERROR - invalid argument for partition mode (0 or 1)\n", MODNAME);
+                return -EINVAL;
+            }
+
+            // sleeping readers look again for messages they can take
+            mutex_lock(&mutex[current_minor]);
+            partition_mode[current_minor] = arg;
+            wake_all_readers(current_minor);
+            mutex_unlock(&mutex[current_minor]);
+            break;
+
+        case GET_PARTITION_MODE_CTL:
+            printk(KERN_INFO "%s: getting partition mode for device file with minor number %d\n", MODNAME, current_minor);
+            return partition_mode[current_minor];
+
+        case SET_PARTITION_KEY_CTL:
+            printk(KERN_INFO "%s: setting partition key for device file with minor number %d\n", MODNAME, current_minor);
+            ((mailslot_file*)filp->private_data)->key = arg;
+            break;
+
+        case GET_PARTITION_COUNT_CTL:
+            printk(KERN_INFO "%s: getting owned partitions for device file with minor number %d\n", MODNAME, current_minor);
+
+            count = 0;
+            mutex_lock(&mutex[current_minor]);
+            for (i = 0; i < NUM_PARTITIONS; i++)
+                if (partition_owner[current_minor][i] == &((mailslot_file*)filp->private_data)->reader)
+                    count++;
+            mutex_unlock(&mutex[current_minor]);
+            return count;
+
+        case CHANGE_WAKEUP_POLICY_CTL:
+            printk(KERN_INFO "%s: changing wakeup policy for device file with minor number %d\n", MODNAME, current_minor);
+
+            if (arg != WAKEUP_FIFO && arg != WAKEUP_CACHE) {
+                printk(KERN_ERR "%s: ERROR - invalid argument for wakeup policy (0 or 1)\n", MODNAME);
+                return -EINVAL;
+            }
+
+            mutex_lock(&mutex[current_minor]);
+            cache_wakeup[current_minor] = arg;
+            mutex_unlock(&mutex[current_minor]);
+            break;
+
+        case GET_WAKEUP_POLICY_CTL:
+            printk(KERN_INFO "%s: getting wakeup policy for device file with minor number %d\n", MODNAME, current_minor);
+            return cache_wakeup[current_minor];
+
+        case SET_READER_CPU_CTL:
+            printk(KERN_INFO "%s: setting reader CPU for device file with minor number %d\n", MODNAME, current_minor);
+
+            if ((long)arg != -1 && (arg >= nr_cpu_ids || !cpu_possible(arg))) {
+                printk(KERN_ERR "%s: ERROR - invalid argument for reader CPU (possible CPU, or -1)\n", MODNAME);
+                return -EINVAL;
+            }
+
+            // read by wake_reader() under the head lock, through the elem of the sleeping reader
+            mutex_lock(&mutex[current_minor]);
+            ((mailslot_file*)filp->private_data)->reader.cpu_hint = (long)arg;
+            mutex_unlock(&mutex[current_minor]);
+            break;
+
+        case CORK_CTL:
+            printk(KERN_INFO "%s: changing cork mode for device file with minor number %d\n", MODNAME, current_minor);
+
+            if (arg != CORK_OFF && arg != CORK_ON) {
+                printk(KERN_ERR "%s: ERROR - invalid argument for cork mode (0 or 1)\n", MODNAME);
+                return -EINVAL;
+            }
+
+            // the staging buffer is allocated on the first cork and kept until close
+            if (arg == CORK_ON && file->staged.payload == NULL) {
+                mutex_lock(&file->cork_lock);
+                if (file->staged.payload == NULL)
+                    file->staged.payload = kmalloc(CORK_BUFFER_SIZE, GFP_KERNEL);
+                mutex_unlock(&file->cork_lock);
+                if (file->staged.payload == NULL)
+                    return -ENOMEM;
+            }
+
+            if (arg == CORK_OFF)
+                cancel_delayed_work_sync(&file->cork_work);
+
+            mutex_lock(&file->cork_lock);
+            file->corked = arg;
+            res = arg == CORK_OFF ? flush_staged(file, write_blk_mode[current_minor]) : 0;
+            mutex_unlock(&file->cork_lock);
+            return res < 0 ? res : 0;
+
+        case GET_CORK_CTL:
+            printk(KERN_INFO "%s: getting cork mode for device file with minor number %d\n", MODNAME, current_minor);
+            return file->corked;
+
+        case CHANGE_CORK_DELAY_CTL:
+            printk(KERN_INFO "%s: changing cork delay for device file with minor number %d\n", MODNAME, current_minor);
+
+            if (arg == 0 || arg > MAX_CORK_DELAY) {
+                printk(KERN_ERR "%s: ERROR - invalid argument for cork delay (us, from 1 to %d)\n", MODNAME, MAX_CORK_DELAY);
+                return -EINVAL;
+            }
+            cork_delay[current_minor] = arg;
+            break;
+
+        case GET_CORK_DELAY_CTL:
+            printk(KERN_INFO "%s: getting cork delay for device file with minor number %d\n", MODNAME, current_minor);
+            return cork_delay[current_minor];
+
+        case READ_EXT_CTL:
+            printk(KERN_INFO "%s: extended read on device file with minor number %d\n", MODNAME, current_minor);
+
+            // it consumes messages as read() does
+            if (!(filp->f_mode & FMODE_READ)) {
+                printk(KERN_ERR "%s: ERROR - extended read on a file not open for reading\n", MODNAME);
+                return -EBADF;
+            }
+
+            if (copy_from_user(&ext, (void *)arg, sizeof(read_ext))) {
+                printk(KERN_ERR "%s: ERROR in copy_from_user()\n", MODNAME);
+                return -EFAULT;
+            }
+
+            // the message is consumed even if the metadata cannot be returned, as read() does with the payload
+            res = mailslot_read_ext(current_minor, filp->private_data, &ext);
+            if (res < 0)
+                return res;
+
+            if (copy_to_user((void *)arg, &ext, sizeof(read_ext))) {
+                printk(KERN_ERR "%s: ERROR in copy_to_user()\n", MODNAME);
+                return -EFAULT;
+            }
+            return res;
+
+        case CALL_CTL:
+            printk(KERN_INFO "%s: call on device file with minor number %d\n", MODNAME, current_minor);
+
+            // the request is written as write() does
+            if (!(filp->f_mode & FMODE_WRITE)) {
+                printk(KERN_ERR "%s: ERROR - call on a file not open for writing\n", MODNAME);
+                return -EBADF;
+            }
+
+            if (copy_from_user(&call, (void *)arg, sizeof(call_request))) {
+                printk(KERN_ERR "%s: ERROR in copy_from_user()\n", MODNAME);
+                return -EFAULT;
+            }
+
+            res = mailslot_call(current_minor, filp->private_data, &call);
+            if (res < 0)
+                return res;
+
+            if (copy_to_user(&((call_request *)arg)->call_id, &call.call_id, sizeof(call.call_id))) {
+                printk(KERN_ERR "%s: ERROR in copy_to_user()\n", MODNAME);
+                return -EFAULT;
+            }
+            return res;
+
+        case MULTICAST_CTL:
+            printk(KERN_INFO "%s: multicast from device file with minor number %d\n", MODNAME, current_minor);
+
+            if (copy_from_user(&mc, (void *)arg, sizeof(multicast))) {
+                printk(KERN_ERR "%s: ERROR in copy_from_user()\n", MODNAME);
+                return -EFAULT;
+            }
+
+            res = mailslot_multicast(file, &mc);
+            if (res < 0)
+                return res;
+
+            if (copy_to_user(((multicast *)arg)->results, mc.results, sizeof(mc.results))) {
+                printk(KERN_ERR "%s: ERROR in copy_to_user()\n", MODNAME);
+                return -EFAULT;
+            }
+            return res;
+
+        case REPLY_CTL:
+            printk(KERN_INFO "%s: reply on device file with minor number %d\n", MODNAME, current_minor);
+
+            if (!(filp->f_mode & FMODE_WRITE)) {
+                printk(KERN_ERR "%s: ERROR - reply on a file not open for writing\n", MODNAME);
+                return -EBADF;
+            }
+
+            if (copy_from_user(&reply, (void *)arg, sizeof(call_reply))) {
+                printk(KERN_ERR "%s: ERROR in copy_from_user()\n", MODNAME);
+                return -EFAULT;
+            }
+            return mailslot_reply(current_minor, &reply);
+
 		default:
 			printk(KERN_ERR "%s: ERROR - inappropriate ioctl for device\n", MODNAME);
 			return -ENOTTY;
@@ -434,6 +1137,33 @@ static long mailslot_ctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	return 0;
 }
 
+// Maps the status page of the mailslot (see mailslot_status), read-only and a single page at offset 0
+static int mailslot_mmap(struct file *filp, struct vm_area_struct *vma) {
+    int current_minor = CURRENT_DEVICE;
+    mailslot_status* status;
+
+    printk(KERN_INFO "%s: mapping status page of device file with minor number %d\n", MODNAME, current_minor);
+
+    if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start != PAGE_SIZE) {
+        printk(KERN_ERR "%s: ERROR - only the first page can be mapped\n", MODNAME);
+        return -EINVAL;
+    }
+
+    if (vma->vm_flags & VM_WRITE) {
+        printk(KERN_ERR "%s: ERROR - the status page is read-only\n", MODNAME);
+        return -EPERM;
+    }
+    vma->vm_flags &= ~VM_MAYWRITE;
+
+    mutex_lock(&mutex[current_minor]);
+    status = get_status_page(current_minor, current_max_segment_size[current_minor]);
+    mutex_unlock(&mutex[current_minor]);
+    if (status == NULL)
+        return -ENOMEM;
+
+    return remap_pfn_range(vma, vma->vm_start, virt_to_phys(status) >> PAGE_SHIFT, PAGE_SIZE, vma->vm_page_prot);
+}
+
 
 static struct file_operations fops = {
     .owner = THIS_MODULE,
@@ -441,52 +1171,121 @@ static struct file_operations fops = {
     .release = mailslot_release,
     .read = mailslot_read,
     .write = mailslot_write,
-    .unlocked_ioctl = mailslot_ctl
+    .unlocked_ioctl = mailslot_ctl,
+    .mmap = mailslot_mmap
 };
 
 
-int init_module(void) {
+static void free_lz4_buffers(void) {
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        vfree(per_cpu(lz4_wrkmem, cpu));
+        kfree(per_cpu(lz4_dst, cpu));
+    }
+}
+
+//----------------------------------------------------------------------
+// Under memory pressure the pools of the minors give back what they keep, see pool_trim(). The scan goes on
+// from the minor after the one the last scan started from, so that no pool is always trimmed first.
+
+static int shrink_cursor;
+
+static unsigned long pool_shrink_count(struct shrinker* shrinker, struct shrink_control* sc) {
+    unsigned long count = 0;
     int i;
+
+    for (i = 0; i < MAX_MINOR_NUM; i++)
+        count += pool_size(&pools[i]);
+    return count;
+}
+
+static unsigned long pool_shrink_scan(struct shrinker* shrinker, struct shrink_control* sc) {
+    unsigned long freed = 0;
+    int i, first = ACCESS_ONCE(shrink_cursor);
+
+    for (i = 0; i < MAX_MINOR_NUM && freed < sc->nr_to_scan; i++)
+        freed += pool_trim(&pools[(first + i) % MAX_MINOR_NUM], sc->nr_to_scan - freed);
+    ACCESS_ONCE(shrink_cursor) = (first + 1) % MAX_MINOR_NUM;
+
+    return freed > 0 ? freed : SHRINK_STOP;
+}
+
+static struct shrinker pool_shrinker = {
+    .count_objects = pool_shrink_count,
+    .scan_objects = pool_shrink_scan,
+    .seeks = DEFAULT_SEEKS
+};
+
+int init_module(void) {
+    int i, cpu;
+
+    for_each_possible_cpu(cpu) {
+        per_cpu(lz4_wrkmem, cpu) = vmalloc(LZ4_MEM_COMPRESS);
+        per_cpu(lz4_dst, cpu) = kmalloc(lz4_compressbound(MAX_SEGMENT_SIZE), GFP_KERNEL);
+        if (per_cpu(lz4_wrkmem, cpu) == NULL || per_cpu(lz4_dst, cpu) == NULL) {
+            printk(KERN_ERR "%s: ERROR - allocation of compression buffers failed\n", MODNAME);
+            free_lz4_buffers();
+            return -ENOMEM;
+        }
+    }
+
 	major = register_chrdev(0, DEVICE_NAME, &fops);
 
 	if (major < 0) {
 	  printk(KERN_ERR "%s: ERROR - registering mail slot device failed\n", MODNAME);
+	  free_lz4_buffers();
 	  return major;
 	}
 
 	printk(KERN_INFO "%s: mail slot device registered. Major number = %d\n", MODNAME, major);
 
     for (i = 0; i < MAX_MINOR_NUM; i++){
-        mailslots[i] = NULL;
+        init_mailslot(i);
         current_max_segment_size[i] = MAX_SEGMENT_SIZE;
         write_blk_mode[i] = BLOCKING_MODE;
         read_blk_mode[i] = BLOCKING_MODE;
-        used_space[i] = 0;
-        mutex_init(&mutex[i]);
-        readers_list[i].head = head;
-        readers_list[i].tail = tail;
-        readers_list[i].head.next = &readers_list[i].tail;
-        readers_list[i].tail.prev = &readers_list[i].head;
-        writers_list[i].head = head;
-        writers_list[i].tail = tail;
-        writers_list[i].head.next = &writers_list[i].tail;
-        writers_list[i].tail.prev = &writers_list[i].head;
+        init_llist_head(&kenqueue_pending[i]);
+        compress_mode[i] = COMPRESSION_OFF;
+        cork_delay[i] = CORK_DELAY;
+        INIT_WORK(&kenqueue_work[i], kenqueue_work_fn);
+    }
+
+    if (register_shrinker(&pool_shrinker) != 0) {
+        printk(KERN_ERR "%s: ERROR - registering pool shrinker failed\n", MODNAME);
+        unregister_chrdev(major, DEVICE_NAME);
+        free_lz4_buffers();
+        return -ENOMEM;
     }
     return 0;
 }
 
 void cleanup_module(void) {
     int i;
+    struct llist_node* node;
+    segment* msg;
+
+    unregister_shrinker(&pool_shrinker);
+
     for(i = 0; i < MAX_MINOR_NUM; i++) {
-        while(mailslots[i] != NULL) {
-            segment* msg_to_delete = mailslots[i];
-            mailslots[i] = mailslots[i]->next;
-            kfree(msg_to_delete->payload);
-            kfree(msg_to_delete);
+        cancel_work_sync(&kenqueue_work[i]);
+        if (notify_ctx[i] != NULL)
+            eventfd_ctx_put(notify_ctx[i]);
+        node = llist_del_all(&kenqueue_pending[i]);
+        while (node != NULL) {
+            msg = llist_entry(node, segment, lnode);
+            node = node->next;
+            free_segment(msg);
         }
-	}
+        cleanup_mailslot(i);
+    }
+
+    // shared payloads freed above may have gone back to the pool of any minor
+    for (i = 0; i < MAX_MINOR_NUM; i++)
+        pool_trim(&pools[i], ULONG_MAX);
 
-	unregister_chrdev(major, DEVICE_NAME);
-	printk(KERN_INFO "%s: mail slot device unregistered. Major number = %d\n", MODNAME, major);
+    free_lz4_buffers();
+    unregister_chrdev(major, DEVICE_NAME);
+    printk(KERN_INFO "%s: mail slot device unregistered. Major number = %d\n", MODNAME, major);
 }
 
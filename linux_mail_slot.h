@@ -1,18 +1,12 @@
 #ifndef LINUX_MAIL_SLOT_HEADER
 #define LINUX_MAIL_SLOT_HEADER
 
-#define MODNAME "MAIL_SLOT"
-#define DEVICE_NAME "mailslot"  /* Device file name in /dev/ */
+#include "mailslot_core.h"
 
-#define MAX_MAIL_SLOT_SIZE (1<<20) // 1MB of max storage (upper limit)
-#define MAX_SEGMENT_SIZE (1<<10) // 1KB of max segment size (upper limit)
-#define MAX_MINOR_NUM (256)
+#define DEVICE_NAME "mailslot"  /* Device file name in /dev/ */
 
 #define CURRENT_DEVICE MINOR(filp->f_dentry->d_inode->i_rdev)
 
-#define BLOCKING_MODE 0
-#define NON_BLOCKING_MODE 1
-
 // IOCTL
 #define CHANGE_WRITE_BLOCKING_MODE_CTL 3
 #define CHANGE_READ_BLOCKING_MODE_CTL 4
@@ -21,30 +15,132 @@
 #define GET_FREESPACE_SIZE_CTL 7
 #define GET_WRITE_BLOCKING_MODE_CTL 8
 #define GET_READ_BLOCKING_MODE_CTL 9
+#define GET_LATENCY_STATS_CTL 10
+#define RESET_LATENCY_STATS_CTL 11
+#define BIND_EVENTFD_CTL 12
+#define CHANGE_COMPRESSION_MODE_CTL 13
+#define GET_COMPRESSION_MODE_CTL 14
+#define GET_USED_MEMORY_CTL 15
+#define READ_EXT_CTL 16
+#define CHANGE_TTL_CTL 17          // ms, 0 disables expiry
+#define GET_TTL_CTL 18
+#define GET_EXPIRED_COUNT_CTL 19
+#define CHANGE_BUSY_POLL_CTL 20    // us, 0 disables busy-polling of blocking readers
+#define GET_BUSY_POLL_CTL 21
+#define CHANGE_PARTITION_MODE_CTL 22
+#define GET_PARTITION_MODE_CTL 23
+#define SET_PARTITION_KEY_CTL 24   // per file, key of the following writes
+#define GET_PARTITION_COUNT_CTL 25 // per file, number of partitions owned
+#define CALL_CTL 26                // request on this minor, then wait for the reply on the reply minor
+#define REPLY_CTL 27               // on the reply minor, wakes up the caller of the correlation id
+#define CHANGE_WAKEUP_POLICY_CTL 28
+#define GET_WAKEUP_POLICY_CTL 29
+#define SET_READER_CPU_CTL 30      // per file, CPU the reader runs on for WAKEUP_CACHE, -1 to use the current one
+#define CORK_CTL 31                // per file, CORK_ON stages small writes, CORK_OFF commits them and stops
+#define GET_CORK_CTL 32
+#define CHANGE_CORK_DELAY_CTL 33   // us, staged writes are committed at most this long after the first one
+#define GET_CORK_DELAY_CTL 34
+#define MULTICAST_CTL 35           // same message to several open mailslots, payload copied once
+#define GET_POOL_STATS_CTL 36
+
+#define MAX_BUSY_POLL 10000    // us, spinning longer than a scheduler wakeup costs is never worth it
+#define CORK_DELAY 1000        // us, default for CHANGE_CORK_DELAY_CTL, rounded up to a jiffy
+#define MAX_CORK_DELAY 1000000 // us
+#define MAX_MULTICAST 16       // target files of a MULTICAST_CTL
+
+#define COMPRESSION_OFF 0
+#define COMPRESSION_ON 1     // messages up to 256 bytes are packed uncompressed
+
+#define PARTITION_OFF 0
+#define PARTITION_ON 1
+
+#define WAKEUP_FIFO 0       // first sleeping reader
+#define WAKEUP_CACHE 1      // sleeping reader sharing the cache of the writer, if any
+
+#define CORK_OFF 0
+#define CORK_ON 1
+
+// argument of BIND_EVENTFD_CTL, fd < 0 removes the binding
+typedef struct eventfd_binding{
+    int fd;
+    int events;
+    int depth;
+} eventfd_binding;
+
+// argument of READ_EXT_CTL: read() of at most len bytes in buf, that also returns the metadata of the message.
+// Timestamps are in ns of CLOCK_MONOTONIC. Sequence numbers are per minor and assigned in arrival order, a single
+// reader sees them increasing, with gaps where other readers took messages.
+// EBADF if the file is not open for reading.
+typedef struct read_ext{
+    char* buf;
+    int len;
+    unsigned long long seq;
+    unsigned long long enqueue_time;
+    unsigned long long dequeue_time;
+    unsigned long long call_id;     // correlation id to answer with REPLY_CTL, 0 if not sent by CALL_CTL
+} read_ext;
+
+// argument of CALL_CTL: writes req_len bytes of req as a request, then sleeps until the reply, of at most
+// reply_len bytes, is stored in reply. Returns the reply size; call_id is set to the correlation id
+// of the request, unique on reply_minor. A signal while waiting for the reply gives EINTR, the request
+// having already been sent. EBADF if the file is not open for writing.
+typedef struct call_request{
+    char* req;
+    int req_len;
+    char* reply;
+    int reply_len;
+    int reply_minor;
+    unsigned long long call_id;
+} call_request;
+
+// argument of MULTICAST_CTL: writes len bytes of buf to each of the first nr_fds mailslot files, as write() on
+// them would, and sets results[i] to what write() would have returned for fds[i] (EBADF if it is not a mailslot
+// open for writing). Returns the number of files the message has been written to.
+typedef struct multicast{
+    char* buf;
+    int len;
+    int nr_fds;
+    int fds[MAX_MULTICAST];
+    int results[MAX_MULTICAST];
+} multicast;
 
-typedef struct segment{
-    int size;
-    char* payload;
-    struct segment* next;
-} segment;
+// returned by GET_POOL_STATS_CTL: use of the recycled segments and pages of the minor, see segment_pool
+typedef struct pool_stats{
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long trimmed;     // given back under memory pressure
+    int segments;                   // kept now
+    int pages;
+} pool_stats;
 
-typedef struct _elem{
-    struct task_struct *task;
-    int pid;
-    struct _elem * next;
-    struct _elem * prev;
-} elem;
+// argument of REPLY_CTL, issued on the reply minor of the call from a file open for writing
+typedef struct call_reply{
+    unsigned long long call_id;
+    char* buf;
+    int len;
+} call_reply;
 
-typedef struct list{
-   elem head;
-   elem tail;
-}list;
+// private data of an open file. Files that read are the readers partitions are spread among: a file opened
+// read-only from its open, one opened O_RDWR from its first read (see register_file()).
+typedef struct mailslot_file{
+    unsigned int key;               // partition key of the messages written through this file
+    int registered;                 // reader is in the partition readers of the minor, see register_file()
+    partition_reader reader;
+    int minor;
+    int corked;                     // writes up to PACKED_MAX_SIZE go to staged, see CORK_CTL
+    struct mutex cork_lock;         // staged is shared by the threads writing through the file
+    segment staged;                 // batch committed on uncork, when full or by cork_work
+    struct delayed_work cork_work;  // armed by the first staged write
+} mailslot_file;
 
 static int mailslot_open(struct inode *, struct file *);
 static int mailslot_release(struct inode *, struct file *);
 static ssize_t mailslot_read(struct file * , char * , size_t , loff_t *);
 static ssize_t mailslot_write(struct file *, const char *, size_t, loff_t *);
 static long mailslot_ctl (struct file *filp, unsigned int param1, unsigned long param2);
+static int mailslot_mmap(struct file *filp, struct vm_area_struct *vma);
+static void kenqueue_work_fn(struct work_struct *work);
+static void cork_work_fn(struct work_struct *work);
 
 
 #endif
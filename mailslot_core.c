@@ -0,0 +1,1566 @@
+/*
+ * Mailslot core: message queue, space and memory accounting, sleeplists, latency histograms
+ * and readiness notification. It has no dependency on the file operations, so that it can be
+ * built in user space on top of Test/ushim.h for microbenchmarks and stress tests.
+ * The module includes this file, every symbol stays static.
+ *
+ * Locking: readers and writers work at opposite ends of the queue and take different locks.
+ *   mutex[minor]       head lock: removal of messages, readers_list, expiry, partitions, configuration
+ *   tail_mutex[minor]  tail lock: appending (and packing) messages, writers_list
+ *   status_lock[minor] status page updates, taken last
+ * When both are needed the head lock is taken first. Readers take the tail lock only to unlink the last
+ * segment, writers take the head lock only to link the first one. Space and memory are shared atomics,
+ * and each side wakes up the sleepers of the other one through the lock of their list.
+ */
+
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/slab.h>     /* For kmalloc, kfree */
+#include <linux/mutex.h>
+#include <linux/wait.h>     /* For wait_queue */
+#include <linux/ktime.h>
+#include <linux/bitops.h>   /* For fls64 */
+#include <linux/atomic.h>
+#include <linux/llist.h>
+#include <linux/eventfd.h>
+#include <linux/spinlock.h>
+#include <linux/topology.h>  /* For cpu_to_node */
+#include <linux/cpumask.h>
+
+// CPUs assumed to share the cache of cpu: those of its package. Neither cpus_share_cache() nor the LLC masks
+// of x86 (cpu_llc_shared_map) are exported to modules, so only packages are told apart: the clusters of a
+// multi-CCX part count as one cache.
+#define cpu_cache_mask(cpu) topology_core_cpumask(cpu)
+#else
+#include "Test/ushim.h"
+#endif
+
+#include "mailslot_core.h"
+
+static segment* mailslots[MAX_MINOR_NUM];
+static segment* mailslots_tail[MAX_MINOR_NUM];
+static segment* open_chunk[MAX_MINOR_NUM][NUM_PARTITIONS];    // per partition, see pack_message()
+static elem head = {NULL, -1, NULL, NULL};
+static elem tail = {NULL, -1, NULL, NULL};
+static list writers_list[MAX_MINOR_NUM];
+static list readers_list[MAX_MINOR_NUM];
+
+static atomic_t used_space[MAX_MINOR_NUM];    // reserved atomically, see reserve_space()
+static atomic_t used_memory[MAX_MINOR_NUM];   // real memory, bounded by MAX_MAIL_SLOT_MEMORY
+static segment_pool pools[MAX_MINOR_NUM];     // recycled segments and pages, see pool_get_segment()
+static struct mutex mutex[MAX_MINOR_NUM];       // head lock
+static struct mutex tail_mutex[MAX_MINOR_NUM];  // tail lock
+static spinlock_t status_lock[MAX_MINOR_NUM];
+static latency_stats latency[MAX_MINOR_NUM];    // read_* under the head lock, write_* under the tail lock
+
+// readiness notification, see BIND_EVENTFD_CTL
+static atomic_t msg_count[MAX_MINOR_NUM];
+static struct eventfd_ctx* notify_ctx[MAX_MINOR_NUM];
+static int notify_events[MAX_MINOR_NUM];
+static int notify_depth[MAX_MINOR_NUM];
+
+// status page, allocated by the first mmap(), and the sequence counters it exposes
+static mailslot_status* status_page[MAX_MINOR_NUM];
+static unsigned long long enqueued[MAX_MINOR_NUM];
+static unsigned long long dequeued[MAX_MINOR_NUM];
+static unsigned long long expired[MAX_MINOR_NUM];     // dropped by drop_expired()
+
+// messages older than ttl[minor] ns are never delivered, 0 disables it (see CHANGE_TTL_CTL)
+static unsigned long long ttl[MAX_MINOR_NUM];
+
+// adaptive busy-polling of blocking readers, see poll_budget() and CHANGE_BUSY_POLL_CTL
+static unsigned long long busy_poll[MAX_MINOR_NUM];       // ns, upper bound of the spin, 0 disables it
+static unsigned long long last_arrival[MAX_MINOR_NUM];
+static unsigned long long arrival_ewma[MAX_MINOR_NUM];    // mean inter-arrival time, ns
+
+// partitioned consumption, see rebalance_partitions() and CHANGE_PARTITION_MODE_CTL
+static int partition_mode[MAX_MINOR_NUM];
+static partition_reader* partition_readers[MAX_MINOR_NUM];
+static partition_reader* partition_owner[MAX_MINOR_NUM][NUM_PARTITIONS];
+
+// wake up the sleeping reader closest to the writer instead of the first one, see wake_reader()
+static int cache_wakeup[MAX_MINOR_NUM];
+
+// request/reply calls, see register_call() and CALL_CTL
+static call_waiter* call_waiters[MAX_MINOR_NUM];      // callers waiting for a reply on the minor
+static unsigned long long call_ids[MAX_MINOR_NUM];    // last correlation id handed out on the minor
+
+DECLARE_WAIT_QUEUE_HEAD(writers_queue);
+DECLARE_WAIT_QUEUE_HEAD(readers_queue);
+DECLARE_WAIT_QUEUE_HEAD(callers_queue);
+
+//----------------------------------------------------------------------
+
+static inline unsigned long long now_ns(void) {
+    return ktime_to_ns(ktime_get());
+}
+
+// histograms are only updated with the lock of their side held, so plain counters are enough
+static inline void lat_record(lat_hist *hist, unsigned long long delta) {
+    int i = fls64(delta);
+
+    if (i >= LAT_HIST_BUCKETS)
+        i = LAT_HIST_BUCKETS - 1;
+    hist->bucket[i]++;
+}
+
+static inline void unlock_and_record(struct mutex* lock, lat_hist *hold, unsigned long long acquired) {
+    lat_record(hold, now_ns() - acquired);
+    mutex_unlock(lock);
+}
+
+static int reserve(atomic_t* used, int amount, int limit) {
+    int old;
+
+    do {
+        old = atomic_read(used);
+        if (amount > limit - old)
+            return 0;
+    } while (atomic_cmpxchg(used, old, old + amount) != old);
+
+    return 1;
+}
+
+// Takes len bytes of the mailslot free space and mem bytes of its memory budget. It is lock-free so that
+// producers in atomic context, which cannot take the mutex, share the same accounting as write().
+// Returns 0 if either is not enough.
+static int reserve_space(int minor, int len, int mem) {
+    if (!reserve(&used_space[minor], len, MAX_MAIL_SLOT_SIZE))
+        return 0;
+
+    if (!reserve(&used_memory[minor], mem, MAX_MAIL_SLOT_MEMORY)) {
+        atomic_sub(len, &used_space[minor]);
+        return 0;
+    }
+    return 1;
+}
+
+static inline void release_space(int minor, int len, int mem) {
+    atomic_sub(len, &used_space[minor]);
+    atomic_sub(mem, &used_memory[minor]);
+}
+
+// real memory pinned by a single (not packed) segment
+static inline int segment_memory(segment* msg) {
+    if (msg->pages != NULL)
+        return sizeof(segment) + ksize(msg->pages) + msg->nr_pages * PAGE_SIZE;
+    return sizeof(segment) + ksize(msg->payload);
+}
+
+// exact with the tail lock held, a hint otherwise
+static inline int writers_waiting(int minor) {
+    return ACCESS_ONCE(writers_list[minor].head.next) != &(writers_list[minor].tail);
+}
+
+// exact with the head lock held, a hint otherwise
+static inline int readers_waiting(int minor) {
+    return ACCESS_ONCE(readers_list[minor].head.next) != &(readers_list[minor].tail);
+}
+
+// wakes up the task of a sleeplist entry, unlinking it; to be called with the lock of its list held
+static inline void wake_elem(elem* e) {
+    struct task_struct* task = e->task;
+
+    e->prev->next = e->next;
+    e->next->prev = e->prev;
+    e->granted = 1;
+    wake_up_process(task);
+}
+
+// Space is handed out to the waiting writers in arrival order: the oldest one gets its request reserved and
+// is woken up as soon as it fits, the others keep waiting behind it even if they would fit, so that a large
+// writer is not starved by a stream of small ones. To be called with the tail lock held after releasing space.
+static void grant_writers(int minor) {
+    elem* first;
+
+    while (writers_waiting(minor)) {
+        first = writers_list[minor].head.next;
+        if (!reserve_space(minor, first->need, first->need_mem))
+            return;
+        wake_elem(first);
+    }
+}
+
+// How close a reader sleeping on cpu is to the waker: 2 same package (see cpu_cache_mask()), 1 same NUMA node,
+// 0 otherwise
+static inline int cpu_proximity(int cpu, int this_cpu) {
+    if (cpumask_test_cpu(cpu, cpu_cache_mask(this_cpu)))
+        return 2;
+    return cpu_to_node(cpu) == cpu_to_node(this_cpu);
+}
+
+// a reader that can take a message with the partition owned by owner
+static inline int can_take(int minor, elem* e, partition_reader* owner) {
+    return !partition_mode[minor] || e->reader == NULL || e->reader == owner;
+}
+
+// Wakes up the sleeping reader that is going to take a message with the given key: the first one in
+// readers_list, or in partition mode the first one owning the partition of the key (or taking any message).
+// With cache_wakeup the closest of the first WAKEUP_SCAN such readers is chosen instead, so that the payload
+// just written is likely still in a cache it shares; readers it is preferred to are passed over at most
+// WAKEUP_MAX_SKIPS times. Woken readers leave the list, so that the next message wakes up someone else.
+// To be called with the head lock held.
+static void wake_reader(int minor, unsigned int key) {
+    elem* aux;
+    elem* chosen = NULL;
+    partition_reader* owner = partition_owner[minor][key % NUM_PARTITIONS];
+    int this_cpu = raw_smp_processor_id();
+    int proximity, best = -1, scanned = 0;
+
+    for (aux = readers_list[minor].head.next; aux != &(readers_list[minor].tail); aux = aux->next) {
+        if (!can_take(minor, aux, owner))
+            continue;
+
+        if (!cache_wakeup[minor] || aux->skipped >= WAKEUP_MAX_SKIPS) {
+            chosen = aux;
+            break;
+        }
+
+        proximity = cpu_proximity(aux->cpu, this_cpu);
+        if (proximity > best) {
+            best = proximity;
+            chosen = aux;
+        }
+        if (best == 2 || ++scanned == WAKEUP_SCAN)
+            break;
+    }
+
+    if (chosen == NULL)
+        return;
+
+    for (aux = readers_list[minor].head.next; aux != chosen; aux = aux->next)
+        if (can_take(minor, aux, owner))
+            aux->skipped++;
+    wake_elem(chosen);
+}
+
+// to be called with the head lock held
+static void wake_all_readers(int minor) {
+    while (readers_list[minor].head.next != &(readers_list[minor].tail))
+        wake_elem(readers_list[minor].head.next);
+}
+
+// eventfd signalling, to be called with either lock held after added messages have been linked; count is the
+// number of messages they brought the mailslot to
+static inline void notify_enqueue(int minor, int count, int added) {
+    if (notify_ctx[minor] == NULL)
+        return;
+
+    if ((notify_events[minor] & NOTIFY_NON_EMPTY) && count == added)
+        eventfd_signal(notify_ctx[minor], 1);
+
+    else if ((notify_events[minor] & NOTIFY_DEPTH) && count - added < notify_depth[minor] && count >= notify_depth[minor])
+        eventfd_signal(notify_ctx[minor], 1);
+}
+
+// to be called with the head lock held after the segment has been unlinked
+static inline void notify_dequeue(int minor) {
+    if (notify_ctx[minor] != NULL && (notify_events[minor] & NOTIFY_SPACE))
+        eventfd_signal(notify_ctx[minor], 1);
+}
+
+static inline void status_begin(mailslot_status* status) {
+    status->seq++;
+    smp_wmb();
+}
+
+static inline void status_end(mailslot_status* status) {
+    smp_wmb();
+    status->seq++;
+}
+
+// Copies the live values in the status page, if mapped. Both sides publish, under status_lock: counters of the
+// other side are read without its lock and may be a step behind, the next update catches up.
+static void publish_status(int minor) {
+    mailslot_status* status = ACCESS_ONCE(status_page[minor]);
+
+    if (status == NULL)
+        return;
+
+    spin_lock(&status_lock[minor]);
+    status_begin(status);
+    status->used_space = atomic_read(&used_space[minor]);
+    status->used_memory = atomic_read(&used_memory[minor]);
+    status->msg_count = atomic_read(&msg_count[minor]);
+    status->enqueued = ACCESS_ONCE(enqueued[minor]);
+    status->dequeued = ACCESS_ONCE(dequeued[minor]);
+    status->expired = ACCESS_ONCE(expired[minor]);
+    status_end(status);
+    spin_unlock(&status_lock[minor]);
+}
+
+// sets the maximum segment size shown in the status page, if mapped
+static void publish_max_segment_size(int minor, int max_segment_size) {
+    mailslot_status* status = ACCESS_ONCE(status_page[minor]);
+
+    if (status == NULL)
+        return;
+
+    spin_lock(&status_lock[minor]);
+    status_begin(status);
+    status->max_segment_size = max_segment_size;
+    status_end(status);
+    spin_unlock(&status_lock[minor]);
+}
+
+// Returns the status page of the mailslot, allocating it the first time. To be called with the head lock held.
+static mailslot_status* get_status_page(int minor, int max_segment_size) {
+    mailslot_status* status = status_page[minor];
+
+    if (status != NULL)
+        return status;
+
+    status = (mailslot_status*)get_zeroed_page(GFP_KERNEL);
+    if (status == NULL)
+        return NULL;
+    status->max_size = MAX_MAIL_SLOT_SIZE;
+    status->max_memory = MAX_MAIL_SLOT_MEMORY;
+    status->max_segment_size = max_segment_size;
+    smp_wmb();
+    status_page[minor] = status;
+    publish_status(minor);
+
+    return status;
+}
+
+// To be called with the tail lock held, and the head lock as well if the mailslot is empty (see
+// lock_head_if_empty()). The segment is complete before it can be reached, and a reader that sees the new
+// tail also sees the link to it.
+static void append_segment(int minor, segment* new_msg) {
+    new_msg->next = NULL;
+    smp_wmb();
+    if (mailslots_tail[minor] == NULL)
+        mailslots[minor] = new_msg;
+    else
+        ACCESS_ONCE(mailslots_tail[minor]->next) = new_msg;
+    smp_wmb();
+    ACCESS_ONCE(mailslots_tail[minor]) = new_msg;
+}
+
+// Linking the first segment also changes the head, so that readers see the mailslot empty or not under their
+// own lock. Takes the head lock, with the tail lock held, if the mailslot is empty; the tail lock is released
+// and taken again after it, to keep the lock order. Returns 1 if the head lock has been taken.
+static int lock_head_if_empty(int minor) {
+    if (mailslots_tail[minor] != NULL)
+        return 0;
+
+    if (!mutex_trylock(&mutex[minor])) {
+        mutex_unlock(&tail_mutex[minor]);
+        mutex_lock(&mutex[minor]);
+        mutex_lock(&tail_mutex[minor]);
+    }
+    return 1;
+}
+
+// unlinks seg, that follows prev (NULL if seg is the head), with both locks held or seg not at the tail
+static void detach_segment(int minor, segment* seg, segment* prev) {
+    if (prev == NULL)
+        mailslots[minor] = seg->next;
+    else
+        prev->next = seg->next;
+
+    if (mailslots_tail[minor] == seg)
+        ACCESS_ONCE(mailslots_tail[minor]) = prev;
+}
+
+// Unlinks seg, that follows prev, with the head lock held. Writers only touch the tail segment and the open
+// chunk, so the tail lock is taken just if seg is one of them; a chunk may have been filled in the meanwhile,
+// so it is unlinked only if still drained. Returns 0 if seg has been left in the mailslot.
+static int unlink_segment(int minor, segment* seg, segment* prev) {
+    int unlinked = 1;
+
+    // The tail only moves forward and a chunk is never opened again: if seg is neither of them now, its next
+    // and its records are set for good. A chunk the caller saw drained may have got a record before a writer
+    // moved past it, so that is checked again.
+    if (seg != ACCESS_ONCE(mailslots_tail[minor]) && seg != ACCESS_ONCE(open_chunk[minor][PARTITION(seg)])) {
+        smp_rmb();
+        if (seg->packed && seg->read_offset != ACCESS_ONCE(seg->write_offset))
+            return 0;
+        detach_segment(minor, seg, prev);
+        return 1;
+    }
+
+    mutex_lock(&tail_mutex[minor]);
+    if (seg->packed && seg->read_offset != seg->write_offset)
+        unlinked = 0;
+    else {
+        detach_segment(minor, seg, prev);
+        if (open_chunk[minor][PARTITION(seg)] == seg)
+            open_chunk[minor][PARTITION(seg)] = NULL;
+    }
+    mutex_unlock(&tail_mutex[minor]);
+
+    return unlinked;
+}
+
+//----------------------------------------------------------------------
+// Pools of the minors. Payloads of single segments are left to kmalloc, whose per-cpu slab caches already
+// absorb bursts; segments and pages are kept here. The pool lock is taken innermost, never in atomic context:
+// producers there (see mailslot_kenqueue_atomic()) allocate with a NULL pool.
+
+// zeroed segment, from pool if it has one, that goes back to pool when freed; NULL if out of memory
+static segment* pool_get_segment(segment_pool* pool, gfp_t flags) {
+    segment* seg = NULL;
+
+    if (pool != NULL) {
+        spin_lock(&pool->lock);
+        seg = pool->segments;
+        if (seg != NULL) {
+            pool->segments = seg->next;
+            pool->nr_segments--;
+            pool->hits++;
+        }
+        else
+            pool->misses++;
+        spin_unlock(&pool->lock);
+    }
+
+    if (seg == NULL) {
+        seg = kmalloc(sizeof(segment), flags);
+        if (seg == NULL)
+            return NULL;
+    }
+
+    memset(seg, 0, sizeof(segment));
+    seg->pool = pool;
+    return seg;
+}
+
+static void pool_put_segment(segment* seg) {
+    segment_pool* pool = seg->pool;
+
+    if (pool != NULL) {
+        spin_lock(&pool->lock);
+        if (pool->nr_segments < POOL_MAX) {
+            seg->next = pool->segments;
+            pool->segments = seg;
+            pool->nr_segments++;
+            seg = NULL;
+        }
+        spin_unlock(&pool->lock);
+    }
+    kfree(seg);
+}
+
+static char* pool_get_page(segment_pool* pool, gfp_t flags) {
+    char* page = NULL;
+
+    if (pool != NULL) {
+        spin_lock(&pool->lock);
+        page = pool->pages;
+        if (page != NULL) {
+            pool->pages = *(char**)page;
+            pool->nr_pages--;
+            pool->hits++;
+        }
+        else
+            pool->misses++;
+        spin_unlock(&pool->lock);
+    }
+
+    if (page == NULL)
+        page = (char*)__get_free_page(flags);
+    return page;
+}
+
+static void pool_put_page(segment_pool* pool, char* page) {
+    if (pool != NULL) {
+        spin_lock(&pool->lock);
+        if (pool->nr_pages < POOL_MAX) {
+            *(char**)page = pool->pages;
+            pool->pages = page;
+            pool->nr_pages++;
+            page = NULL;
+        }
+        spin_unlock(&pool->lock);
+    }
+
+    if (page != NULL)
+        free_page((unsigned long)page);
+}
+
+// segments and pages kept by pool, exact only with its lock held
+static inline unsigned long pool_size(segment_pool* pool) {
+    return ACCESS_ONCE(pool->nr_segments) + ACCESS_ONCE(pool->nr_pages);
+}
+
+// Gives back up to nr segments and pages of pool to the allocator, pages first, and returns how many
+static unsigned long pool_trim(segment_pool* pool, unsigned long nr) {
+    segment* seg;
+    char* page;
+    unsigned long freed = 0;
+
+    while (freed < nr) {
+        seg = NULL;
+        spin_lock(&pool->lock);
+        page = pool->pages;
+        if (page != NULL) {
+            pool->pages = *(char**)page;
+            pool->nr_pages--;
+        }
+        else if ((seg = pool->segments) != NULL) {
+            pool->segments = seg->next;
+            pool->nr_segments--;
+        }
+        if (page != NULL || seg != NULL)
+            pool->trimmed++;
+        spin_unlock(&pool->lock);
+
+        if (page == NULL && seg == NULL)
+            break;
+        if (page != NULL)
+            free_page((unsigned long)page);
+        kfree(seg);
+        freed++;
+    }
+    return freed;
+}
+
+//----------------------------------------------------------------------
+
+static void put_shared(segment* owner);
+
+// frees msg, its pages and segment going back to its pool
+static void free_segment(segment* msg) {
+    int i;
+
+    if (msg->shared != NULL) {
+        put_shared(msg->shared);
+        pool_put_segment(msg);
+        return;
+    }
+
+    if (msg->pages != NULL) {
+        for (i = 0; i < msg->nr_pages; i++)
+            pool_put_page(msg->pool, msg->pages[i]);
+        kfree(msg->pages);
+    }
+    else if (msg->packed)
+        pool_put_page(msg->pool, msg->payload);
+    else
+        kfree(msg->payload);
+    pool_put_segment(msg);
+}
+
+// Allocates a segment for len bytes. Up to MAX_SEGMENT_SIZE the payload is a kmalloc buffer, above it a vector
+// of order-0 pages, so that large messages never need high-order allocations. Segment and pages come from pool,
+// the one of the minor the message is for, or from the allocator if NULL. Returns NULL if out of memory.
+static segment* alloc_segment(segment_pool* pool, size_t len, gfp_t flags) {
+    segment* msg;
+    int i;
+
+    msg = pool_get_segment(pool, flags);
+    if (msg == NULL)
+        return NULL;
+
+    if (len <= MAX_SEGMENT_SIZE) {
+        msg->payload = kmalloc(len, flags);
+        if (msg->payload == NULL) {
+            pool_put_segment(msg);
+            return NULL;
+        }
+        return msg;
+    }
+
+    msg->pages = kzalloc(DIV_ROUND_UP(len, PAGE_SIZE) * sizeof(char*), flags);
+    if (msg->pages == NULL) {
+        pool_put_segment(msg);
+        return NULL;
+    }
+
+    for (i = 0; i < DIV_ROUND_UP(len, PAGE_SIZE); i++) {
+        msg->pages[i] = pool_get_page(pool, flags);
+        if (msg->pages[i] == NULL) {
+            free_segment(msg);
+            return NULL;
+        }
+        msg->nr_pages++;
+    }
+    return msg;
+}
+
+// Segment for one of the minors of a multicast (see MULTICAST_CTL) that shares the payload of owner, filled
+// once, instead of a copy of its own. Each minor still accounts the whole payload, so that its limits hold
+// whichever minor keeps it last. Returns NULL if out of memory.
+static segment* share_segment(segment* owner, gfp_t flags) {
+    segment* msg = pool_get_segment(owner->pool, flags);
+
+    if (msg == NULL)
+        return NULL;
+
+    msg->size = owner->size;
+    msg->orig_size = owner->orig_size;
+    msg->payload = owner->payload;
+    msg->pages = owner->pages;
+    msg->nr_pages = owner->nr_pages;
+    msg->shared = owner;
+    atomic_inc(&owner->refs);
+    return msg;
+}
+
+// drops a reference to a shared payload, freeing it with the last one
+static void put_shared(segment* owner) {
+    if (atomic_dec_and_test(&owner->refs))
+        free_segment(owner);
+}
+
+// copies len bytes from buf in the payload of msg, allocated by alloc_segment()
+static void copy_to_segment(segment* msg, const char* buf, size_t len) {
+    int i;
+
+    if (msg->pages == NULL) {
+        memcpy(msg->payload, buf, len);
+        return;
+    }
+
+    for (i = 0; i < msg->nr_pages; i++)
+        memcpy(msg->pages[i], buf + i * PAGE_SIZE, min_t(size_t, PAGE_SIZE, len - i * PAGE_SIZE));
+}
+
+// copies the payload of a large segment (len bytes) in buf
+static void copy_from_pages(segment* msg, char* buf, size_t len) {
+    int i;
+
+    for (i = 0; i < msg->nr_pages; i++)
+        memcpy(buf + i * PAGE_SIZE, msg->pages[i], min_t(size_t, PAGE_SIZE, len - i * PAGE_SIZE));
+}
+
+// messages small enough are copied in the open chunk of the mailslot instead of being linked
+static inline int is_packable(segment* msg) {
+    return !msg->compressed && !msg->batch && msg->size <= PACKED_MAX_SIZE;
+}
+
+// A chunk only holds messages of the same partition, so that in partition mode it belongs to a single reader;
+// each partition has a chunk open. To be called with the tail lock held.
+static inline int chunk_room(int minor, segment* new_msg) {
+    segment* chunk = open_chunk[minor][PARTITION(new_msg)];
+
+    return chunk != NULL &&
+            PAGE_SIZE - chunk->write_offset >= RECORD_SPACE(new_msg->size);
+}
+
+static int batch_memory(segment* batch, segment** chunks);
+
+// memory new_msg will pin once added to the mailslot, to be called with the tail lock held
+static int memory_cost(int minor, segment* new_msg) {
+    if (new_msg->batch)
+        return batch_memory(new_msg, open_chunk[minor]);
+
+    if (!is_packable(new_msg))
+        return segment_memory(new_msg);
+
+    return chunk_room(minor, new_msg) ? 0 : CHUNK_MEMORY;
+}
+
+// Copies new_msg in the open chunk of its partition, starting a new one if it is full. The open chunk keeps taking records
+// after single segments have been linked behind it, so that they do not cost a page each: its meta.seq is the
+// one of its first record, and find_message() sorts the records out by seq. The space (and the memory of the
+// new chunk) is already reserved. To be called with the tail lock held, and the head lock if the mailslot is
+// empty. Readers may be draining the same chunk: a record is complete before write_offset covers it, and a
+// new chunk is linked only once it holds its first record.
+static int pack_message(int minor, segment* new_msg) {
+    segment* chunk = open_chunk[minor][PARTITION(new_msg)];
+    record* rec;
+    int new_chunk = !chunk_room(minor, new_msg);
+
+    if (new_chunk) {
+        chunk = pool_get_segment(&pools[minor], GFP_KERNEL);
+        if (chunk == NULL)
+            return -ENOMEM;
+        chunk->payload = pool_get_page(&pools[minor], GFP_KERNEL);
+        if (chunk->payload == NULL) {
+            pool_put_segment(chunk);
+            return -ENOMEM;
+        }
+        chunk->packed = 1;
+        chunk->meta.key = new_msg->meta.key;
+        chunk->meta.seq = new_msg->meta.seq;
+    }
+
+    rec = (record*)(chunk->payload + chunk->write_offset);
+    rec->size = new_msg->size;
+    rec->meta = new_msg->meta;
+    memcpy(rec + 1, new_msg->payload, new_msg->size);
+    smp_wmb();
+    ACCESS_ONCE(chunk->write_offset) = chunk->write_offset + RECORD_SPACE(new_msg->size);
+
+    // the records of the chunk closed here come before the barrier in append_segment(), see unlink_segment()
+    if (new_chunk) {
+        append_segment(minor, chunk);
+        ACCESS_ONCE(open_chunk[minor][PARTITION(chunk)]) = chunk;
+    }
+
+    return 0;
+}
+
+// first unread record of a chunk, with the head lock held; a linked chunk always has one
+static inline record* first_record(segment* chunk) {
+    smp_rmb();
+    return (record*)(chunk->payload + chunk->read_offset);
+}
+
+// Moves chunk (that follows prev) past its first record of size bytes of payload, unlinking the chunk once
+// it has been drained. To be called with the head lock held.
+static void consume_record(int minor, segment* chunk, segment* prev, int size) {
+    chunk->read_offset += RECORD_SPACE(size);
+    release_space(minor, size, 0);
+
+    if (chunk->read_offset == ACCESS_ONCE(chunk->write_offset) && unlink_segment(minor, chunk, prev)) {
+        release_space(minor, 0, CHUNK_MEMORY);
+        free_segment(chunk);    // kept in the pool for the next packed message
+    }
+}
+
+//----------------------------------------------------------------------
+// Batches of small messages staged by a corked writer (see CORK_CTL). Records are laid out as in a chunk,
+// and enqueue_segment() commits a whole batch at once: the space of all of them is reserved together and they
+// are packed one after the other under the tail lock, so no other message gets in between and a single
+// lock round trip is paid.
+
+static inline void clear_batch(segment* batch) {
+    batch->size = 0;
+    batch->orig_size = 0;
+    batch->records = 0;
+    batch->write_offset = 0;
+}
+
+// Appends a message of len bytes (up to PACKED_MAX_SIZE) to batch, whose payload holds CORK_BUFFER_SIZE bytes.
+// Returns 0 if it is full.
+static int stage_record(segment* batch, const char* buf, int len, unsigned int key) {
+    record* rec;
+
+    if (CORK_BUFFER_SIZE - batch->write_offset < RECORD_SPACE(len))
+        return 0;
+
+    rec = (record*)(batch->payload + batch->write_offset);
+    memset(&rec->meta, 0, sizeof(msg_meta));
+    rec->size = len;
+    rec->meta.key = key;
+    memcpy(rec + 1, buf, len);
+
+    batch->write_offset += RECORD_SPACE(len);
+    batch->size += len;
+    batch->orig_size += len;
+    batch->records++;
+    return 1;
+}
+
+// Memory the records of batch will pin: the chunks they start, filling first the open chunks of their
+// partitions (chunks NULL if none) as pack_message() does. To be called with the tail lock held.
+static int batch_memory(segment* batch, segment** chunks) {
+    record* rec;
+    int offset, p, mem = 0;
+    int room[NUM_PARTITIONS];
+
+    for (p = 0; p < NUM_PARTITIONS; p++)
+        room[p] = (chunks != NULL && chunks[p] != NULL) ? PAGE_SIZE - chunks[p]->write_offset : 0;
+
+    for (offset = 0; offset < batch->write_offset; offset += RECORD_SPACE(rec->size)) {
+        rec = (record*)(batch->payload + offset);
+        p = PARTITION(rec);
+        if (room[p] < RECORD_SPACE(rec->size)) {
+            mem += CHUNK_MEMORY;
+            room[p] = PAGE_SIZE;
+        }
+        room[p] -= RECORD_SPACE(rec->size);
+    }
+    return mem;
+}
+
+// Packs the records of batch, each one stamped as a message of its own, with mem bytes of memory reserved for
+// them. Returns how many have been packed: fewer than batch->records only if a chunk could not be allocated,
+// the space of the others is released. To be called as pack_message().
+static int pack_batch(int minor, segment* batch, int mem) {
+    segment msg;
+    record* rec;
+    segment* chunk;
+    int offset, packed = 0, chunks = 0;
+    unsigned long long now = now_ns();
+
+    memset(&msg, 0, sizeof(segment));
+    for (offset = 0; offset < batch->write_offset; offset += RECORD_SPACE(rec->size)) {
+        rec = (record*)(batch->payload + offset);
+        msg.size = rec->size;
+        msg.orig_size = rec->size;
+        msg.payload = (char*)(rec + 1);
+        msg.meta = rec->meta;
+        msg.meta.enqueue_time = now;
+        msg.meta.seq = enqueued[minor];
+
+        chunk = open_chunk[minor][PARTITION(&msg)];
+        if (pack_message(minor, &msg) < 0)
+            break;
+        if (open_chunk[minor][PARTITION(&msg)] != chunk)
+            chunks++;
+        ACCESS_ONCE(enqueued[minor]) = enqueued[minor] + 1;
+        packed++;
+    }
+
+    if (packed < batch->records) {
+        printk(KERN_ERR "%s: ERROR - allocation of a chunk failed, %d staged messages dropped\n", MODNAME, batch->records - packed);
+        for (; offset < batch->write_offset; offset += RECORD_SPACE(rec->size)) {
+            rec = (record*)(batch->payload + offset);
+            release_space(minor, rec->size, 0);
+        }
+        release_space(minor, 0, mem - chunks * CHUNK_MEMORY);
+        grant_writers(minor);
+    }
+    return packed;
+}
+
+// Wakes up a reader for the message just enqueued with the given key or, if batch is not NULL, one per record
+// as long as any is sleeping. To be called with the head lock held.
+static void wake_readers(int minor, segment* batch, unsigned int key) {
+    record* rec;
+    int offset;
+
+    if (batch == NULL) {
+        wake_reader(minor, key);
+        return;
+    }
+
+    for (offset = 0; offset < batch->write_offset && readers_waiting(minor); offset += RECORD_SPACE(rec->size)) {
+        rec = (record*)(batch->payload + offset);
+        wake_reader(minor, rec->meta.key);
+    }
+}
+
+// Wakes up the writers for the space released by a reader, with the head lock held. A writer joins
+// writers_list and then looks at the space, the reader releases the space and then looks at the list:
+// with a full barrier in between on both sides, at least one of them sees the other.
+static void release_to_writers(int minor) {
+    smp_mb();
+    if (!writers_waiting(minor))
+        return;
+
+    mutex_lock(&tail_mutex[minor]);
+    grant_writers(minor);
+    mutex_unlock(&tail_mutex[minor]);
+}
+
+// Same handshake for messages linked by a writer, out of the tail lock: readers join readers_list and then
+// look at the mailslot again before sleeping. See wake_readers() for batch and key.
+static void wake_reader_from_tail(int minor, segment* batch, unsigned int key) {
+    smp_mb();
+    if (!readers_waiting(minor))
+        return;
+
+    mutex_lock(&mutex[minor]);
+    wake_readers(minor, batch, key);
+    mutex_unlock(&mutex[minor]);
+}
+
+static segment* find_message(int minor, partition_reader* reader, segment** prev);
+
+// Drops the expired messages at the head of the mailslot and returns how many, waking up the writers for
+// the reclaimed space. Messages are taken in enqueue order (see find_message()), so the scan stops at the
+// first one still alive and no timer is needed. To be called with the head lock held.
+static int drop_expired(int minor) {
+    segment* first;
+    segment* prev;
+    record* rec;
+    unsigned long long now;
+    int dropped = 0;
+
+    if (ttl[minor] == 0 || mailslots[minor] == NULL)
+        return 0;
+
+    now = now_ns();
+    while ((first = find_message(minor, NULL, &prev)) != NULL) {
+        if (first->packed) {
+            rec = first_record(first);
+            if (now - rec->meta.enqueue_time <= ttl[minor])
+                break;
+            consume_record(minor, first, prev, rec->size);
+        }
+        else {
+            if (now - first->meta.enqueue_time <= ttl[minor])
+                break;
+            unlink_segment(minor, first, prev);
+            release_space(minor, first->size, segment_memory(first));
+            free_segment(first);
+        }
+        atomic_sub(1, &msg_count[minor]);
+        dropped++;
+    }
+
+    if (dropped == 0)
+        return 0;
+
+    printk(KERN_INFO "%s: %d expired messages dropped\n", MODNAME, dropped);
+    ACCESS_ONCE(expired[minor]) = expired[minor] + dropped;
+    release_to_writers(minor);
+    notify_dequeue(minor);
+    publish_status(minor);
+
+    return dropped;
+}
+
+// updates the mean inter-arrival time (EWMA, weight 1/8) with a message enqueued at now, with the tail lock held
+static inline void track_arrival(int minor, unsigned long long now) {
+    if (last_arrival[minor] != 0)
+        ACCESS_ONCE(arrival_ewma[minor]) = (7 * arrival_ewma[minor] + (now - last_arrival[minor])) / 8;
+    last_arrival[minor] = now;
+}
+
+// How long a reader finding the mailslot empty spins before going to sleep: twice the mean inter-arrival
+// time, so that the next message is likely caught, but only if it is within the configured budget. Slow
+// streams go to sleep immediately, and so does everyone on a single CPU, where spinning only delays the
+// producer. In partition mode the head may belong to someone else, so readers never spin.
+// To be called with the head lock held.
+static unsigned long long poll_budget(int minor) {
+    unsigned long long expected = ACCESS_ONCE(arrival_ewma[minor]);
+
+    if (busy_poll[minor] == 0 || expected == 0 || expected > busy_poll[minor] || num_online_cpus() == 1 ||
+            partition_mode[minor])
+        return 0;
+
+    return 2 * expected < busy_poll[minor] ? 2 * expected : busy_poll[minor];
+}
+
+// spins out of critical section until a message shows up at the head or budget ns have passed
+static void spin_on_head(int minor, unsigned long long budget) {
+    unsigned long long deadline = now_ns() + budget;
+
+    while (ACCESS_ONCE(mailslots[minor]) == NULL && !need_resched() && !signal_pending(current) &&
+            now_ns() < deadline)
+        cpu_relax();
+}
+
+// Partition p goes to the reader in position p % n of the n registered ones, so that partitions are spread
+// evenly and each one has a single owner. In partition mode sleeping readers are woken up to look at their new
+// partitions; otherwise ownership does not matter to them and they are left asleep. To be called with the
+// head lock held.
+static void rebalance_partitions(int minor) {
+    partition_reader* reader;
+    int i, n = 0, p;
+
+    for (reader = partition_readers[minor]; reader != NULL; reader = reader->next)
+        n++;
+
+    for (p = 0; p < NUM_PARTITIONS; p++)
+        partition_owner[minor][p] = NULL;
+
+    for (reader = partition_readers[minor], i = 0; reader != NULL; reader = reader->next, i++)
+        for (p = i; p < NUM_PARTITIONS; p += n)
+            partition_owner[minor][p] = reader;
+
+    if (partition_mode[minor])
+        wake_all_readers(minor);
+}
+
+// adds a reader file to the minor at open, to be called with the head lock held
+static void register_reader(int minor, partition_reader* reader) {
+    partition_reader** aux = &partition_readers[minor];
+
+    while (*aux != NULL)
+        aux = &(*aux)->next;
+    reader->next = NULL;
+    *aux = reader;
+    rebalance_partitions(minor);
+}
+
+// removes a reader file at release, to be called with the head lock held
+static void unregister_reader(int minor, partition_reader* reader) {
+    partition_reader** aux = &partition_readers[minor];
+
+    while (*aux != NULL && *aux != reader)
+        aux = &(*aux)->next;
+    if (*aux != NULL)
+        *aux = reader->next;
+    rebalance_partitions(minor);
+}
+
+// First message reader can take (NULL if none), prev is set to the segment before it. That is the oldest
+// message, in partition mode the oldest one in a partition owned by reader; reader NULL (in-kernel consumers)
+// takes any message. Segments are linked in enqueue order, but the records of a chunk may be newer than the
+// segments behind it (see pack_message()): the scan stops at the first segment linked after the best
+// message so far, usually the second one. To be called with the head lock held, writers may be appending
+// meanwhile.
+static segment* find_message(int minor, partition_reader* reader, segment** prev) {
+    segment* seg;
+    segment* before = NULL;
+    segment* found = NULL;
+    unsigned long long seq, found_seq = 0;
+    int owned_only = partition_mode[minor] && reader != NULL;
+
+    *prev = NULL;
+    for (seg = mailslots[minor]; seg != NULL; before = seg, seg = ACCESS_ONCE(seg->next)) {
+        if (found != NULL && seg->meta.seq > found_seq)
+            break;
+        if (owned_only && partition_owner[minor][PARTITION(seg)] != reader)
+            continue;
+
+        seq = seg->packed ? first_record(seg)->meta.seq : seg->meta.seq;
+        if (found == NULL || seq < found_seq) {
+            found = seg;
+            found_seq = seq;
+            *prev = before;
+        }
+    }
+    return found;
+}
+
+// uncompressed payload of a dequeued message, NULL if it is compressed or large and has to be copied
+// with copy_message()
+static inline char* message_data(message* msg) {
+    if (msg->seg == NULL)
+        return msg->packed_payload;
+    if (!msg->seg->compressed && msg->seg->pages == NULL)
+        return msg->seg->payload;
+    return NULL;
+}
+
+static void release_message(message* msg) {
+    if (msg->seg != NULL)
+        free_segment(msg->seg);
+}
+
+//----------------------------------------------------------------------
+
+// Removes the first message of the mailslot (in partition mode, the first one reader can take, see
+// find_message()) if it fits in len bytes and returns its size.
+// Single segments are detached into msg, packed messages are copied in msg->packed_payload; the caller
+// copies the payload (see copy_message()) and releases msg out of critical section. msg also carries the
+// metadata stamped at enqueue and the dequeue time. Shared by read() and by the in-kernel consumers.
+static ssize_t dequeue_segment(int current_minor, partition_reader* reader, size_t len, int blk_mode, message* msg) {
+    int res, polled = 0;
+    unsigned long long budget;
+    elem me;
+    segment* first;
+    segment* prev;
+    record* rec = NULL;
+    msg_meta* meta;
+    elem* aux;
+    unsigned long long start, acquired, woken;
+    latency_stats *stats = &latency[current_minor];
+
+    me.task = current;
+    me.pid = current->pid;
+    me.next = NULL;
+    me.prev = NULL;
+    me.reader = reader;
+
+    // entering in critical section
+    start = now_ns();
+    if (blk_mode == BLOCKING_MODE) {
+        if (mutex_lock_interruptible(&mutex[current_minor])) {
+            printk(KERN_ERR "%s: ERROR - process %d has been woken up by a signal\n", MODNAME, current->pid);
+            return -ERESTARTSYS;
+        }
+    }
+
+    else {
+        if (!mutex_trylock(&mutex[current_minor])) {
+            printk(KERN_ERR "%s: ERROR - non-blocking read operation and resource not available\n", MODNAME);
+            return -EAGAIN;
+        }
+    }
+    acquired = now_ns();
+    lat_record(&stats->read_lock_wait, acquired - start);
+    drop_expired(current_minor);
+
+    // there is nothing to read
+    while((first = find_message(current_minor, reader, &prev)) == NULL) {
+
+        printk(KERN_INFO "%s: mailslot is empty, nothing to read\n", MODNAME);
+
+        // if non-blocking, return (all or nothing)
+        if (blk_mode == NON_BLOCKING_MODE) {
+            printk(KERN_ERR "%s: ERROR - non-blocking read operation and nothing to read\n", MODNAME);
+            unlock_and_record(&mutex[current_minor], &stats->read_lock_hold, acquired);
+            return -EAGAIN;
+        }
+
+        // spin on the head for a while before paying for a sleep and a wakeup, once per read
+        budget = polled ? 0 : poll_budget(current_minor);
+        polled = 1;
+        if (budget > 0) {
+            unlock_and_record(&mutex[current_minor], &stats->read_lock_hold, acquired);
+            spin_on_head(current_minor, budget);
+
+            start = now_ns();
+            if (mutex_lock_interruptible(&mutex[current_minor])) {
+                printk(KERN_ERR "%s: ERROR - process %d has been woken up by a signal\n", MODNAME, current->pid);
+                return -ERESTARTSYS;
+            }
+            acquired = now_ns();
+            lat_record(&stats->read_lock_wait, acquired - start);
+            drop_expired(current_minor);
+            continue;
+        }
+
+        // put the task in readers_list
+        aux = &(readers_list[current_minor].tail);
+        if (aux->prev == NULL) {
+            printk(KERN_ERR "%s: ERROR - malformed readers sleeplist, service damaged!\n", MODNAME);
+            unlock_and_record(&mutex[current_minor], &stats->read_lock_hold, acquired);
+            return -1;
+        }
+        me.granted = 0;
+        me.skipped = 0;
+        me.cpu = (reader != NULL && reader->cpu_hint >= 0) ? reader->cpu_hint : raw_smp_processor_id();
+        aux->prev->next = &me;
+        me.prev = aux->prev;
+        me.next = aux;
+        aux->prev = &me;
+
+        // a writer that linked a message before seeing the task in the list did not wake anybody up
+        smp_mb();
+        if (find_message(current_minor, reader, &prev) != NULL) {
+            me.prev->next = me.next;
+            me.next->prev = me.prev;
+            continue;
+        }
+
+        unlock_and_record(&mutex[current_minor], &stats->read_lock_hold, acquired);
+
+        printk(KERN_INFO "%s: process %d goes to sleep\n", MODNAME, current->pid);
+
+        // going to sleep out of critical section, wake_reader() unlinks the task
+        start = now_ns();
+        res = wait_event_interruptible(readers_queue, me.granted);
+        woken = now_ns();
+
+        // the mutex is taken in any case, to leave readers_list
+        mutex_lock(&mutex[current_minor]);
+        acquired = now_ns();
+        lat_record(&stats->read_lock_wait, acquired - woken);
+        lat_record(&stats->read_blocked, woken - start);
+
+        if (res != 0) {
+            printk(KERN_ERR "%s: ERROR - process %d has been woken up by a signal\n", MODNAME, current->pid);
+            if (!me.granted) {
+                me.prev->next = me.next;
+                me.next->prev = me.prev;
+            }
+            // a wakeup meant for a message is passed on
+            else if (mailslots[current_minor] != NULL)
+                wake_reader(current_minor, mailslots[current_minor]->meta.key);
+            unlock_and_record(&mutex[current_minor], &stats->read_lock_hold, acquired);
+            return -ERESTARTSYS;
+        }
+
+        printk(KERN_INFO "%s: process %d has been woken up\n", MODNAME, current->pid);
+        drop_expired(current_minor);
+    }
+
+    if (first->packed) {
+        rec = first_record(first);
+        msg->size = rec->size;
+        meta = &rec->meta;
+    }
+    else {
+        msg->size = first->orig_size;
+        meta = &first->meta;
+    }
+
+    printk(KERN_INFO "%s : length to read = %zu and message size = %d\n", MODNAME, len, msg->size);
+
+    // length to read < first segment size
+    if(len <  msg->size){
+        printk(KERN_ERR "%s: ERROR - trying to read an amount of data less than first segment size\n", MODNAME);
+        unlock_and_record(&mutex[current_minor], &stats->read_lock_hold, acquired);
+        return -EINVAL;
+    }
+
+    // in case of malformed writers sleeplist, leave the mailslot untouched
+    aux = &(writers_list[current_minor].head);
+    if (aux == NULL) {
+        printk(KERN_ERR "%s: ERROR - malformed writers sleeplist, service damaged!\n", MODNAME);
+        unlock_and_record(&mutex[current_minor], &stats->read_lock_hold, acquired);
+        return -1;
+    }
+
+    len = msg->size;
+    msg->meta = *meta;
+    msg->dequeue_time = now_ns();
+    lat_record(&stats->residency, msg->dequeue_time - meta->enqueue_time);
+
+    if (first->packed) {
+        // the chunk stays in the mailslot: copy the record in critical section
+        memcpy(msg->packed_payload, rec + 1, len);
+        msg->seg = NULL;
+        consume_record(current_minor, first, prev, len);
+    }
+    else {
+        msg->seg = first;
+        unlink_segment(current_minor, first, prev);
+        release_space(current_minor, first->size, segment_memory(first));
+    }
+    atomic_sub(1, &msg_count[current_minor]);
+    ACCESS_ONCE(dequeued[current_minor]) = dequeued[current_minor] + 1;
+
+    // time to awake the writers whose space is now available
+    release_to_writers(current_minor);
+    notify_dequeue(current_minor);
+    publish_status(current_minor);
+
+    unlock_and_record(&mutex[current_minor], &stats->read_lock_hold, acquired);
+
+    return len;
+}
+
+//----------------------------------------------------------------------
+
+// Adds the message in new_msg (payload already filled out of critical section) at the end of the mailslot,
+// going to sleep if the free space is not enough. Packable messages are copied in a chunk and new_msg stays
+// to the caller, that can keep it on the stack; other segments are linked. On failure the caller owns new_msg.
+// A batch (see stage_record()) is added as a whole, its records packed and new_msg left to the caller.
+// len is the message size, new_msg->size the stored (possibly compressed) one that is accounted.
+// Works under the tail lock, so that it does not wait for readers. Shared by write() and by the in-kernel producers.
+static ssize_t enqueue_segment(int current_minor, segment* new_msg, size_t len, int blk_mode) {
+    int res, mem, cost, reserved, dropped, head_locked, count, added;
+    unsigned int key = new_msg->meta.key;
+    segment* batch = new_msg->batch ? new_msg : NULL;
+    elem me;
+    elem* aux;
+    unsigned long long start, acquired, woken;
+    latency_stats *stats = &latency[current_minor];
+
+    me.task = current;
+    me.pid = current->pid;
+    me.next = NULL;
+    me.prev = NULL;
+
+    start = now_ns();
+    if (blk_mode == BLOCKING_MODE) {
+        if (mutex_lock_interruptible(&tail_mutex[current_minor])) {
+                printk(KERN_ERR "%s: ERROR - process %d has been woken up by a signal\n", MODNAME, current->pid);
+                return -ERESTARTSYS;
+        }
+    }
+
+    else {
+        if (!mutex_trylock(&tail_mutex[current_minor])) {
+            printk(KERN_ERR "%s: ERROR - non-blocking write operation and resource not available\n", MODNAME);
+            return -EAGAIN;
+        }
+    }
+    acquired = now_ns();
+    lat_record(&stats->write_lock_wait, acquired - start);
+
+    // mailslot is full or free space is not enough, or older writers are waiting: space goes in arrival order
+    mem = memory_cost(current_minor, new_msg);
+    reserved = !writers_waiting(current_minor) && reserve_space(current_minor, new_msg->size, mem);
+
+    // under pressure, reclaim the space of expired messages before giving up; that is done at the head
+    if (!reserved && ACCESS_ONCE(ttl[current_minor]) != 0) {
+        mutex_unlock(&tail_mutex[current_minor]);
+        mutex_lock(&mutex[current_minor]);
+        dropped = drop_expired(current_minor);
+        mutex_unlock(&mutex[current_minor]);
+        mutex_lock(&tail_mutex[current_minor]);
+
+        if (dropped > 0) {
+            mem = memory_cost(current_minor, new_msg);
+            reserved = !writers_waiting(current_minor) && reserve_space(current_minor, new_msg->size, mem);
+        }
+    }
+
+    if (!reserved) {
+
+        printk(KERN_INFO "%s: mailslot full or insufficient space\n", MODNAME);
+
+        // if non-blocking, return (all or nothing)
+        if (blk_mode == NON_BLOCKING_MODE) {
+            printk(KERN_ERR "%s: ERROR - non-blocking write operation and insufficient space\n", MODNAME);
+            unlock_and_record(&tail_mutex[current_minor], &stats->write_lock_hold, acquired);
+            return -EAGAIN;
+        }
+
+        // put the task at the end of writers_list; a packed message asks for a whole chunk, since the open
+        // one may be full by the time the space is granted (a batch, for chunks of its own)
+        aux = &(writers_list[current_minor].tail);
+        if (aux->prev == NULL) {
+            printk(KERN_ERR "%s: ERROR - malformed writers sleeplist, service damaged!\n", MODNAME);
+            unlock_and_record(&tail_mutex[current_minor], &stats->write_lock_hold, acquired);
+            return -1;
+        }
+        me.need = new_msg->size;
+        if (batch != NULL)
+            me.need_mem = batch_memory(batch, NULL);
+        else
+            me.need_mem = is_packable(new_msg) ? CHUNK_MEMORY : mem;
+        me.granted = 0;
+        aux->prev->next = &me;
+        me.prev = aux->prev;
+        me.next = aux;
+        aux->prev = &me;
+
+        // space released by a reader that did not see the task in the list yet is granted here
+        smp_mb();
+        grant_writers(current_minor);
+
+        unlock_and_record(&tail_mutex[current_minor], &stats->write_lock_hold, acquired);
+
+        printk(KERN_INFO "%s: process %d goes to sleep\n", MODNAME, current->pid);
+
+        // going to sleep out of critical section, grant_writers() reserves the space and unlinks the task
+        start = now_ns();
+        res = wait_event_interruptible(writers_queue, me.granted);
+        woken = now_ns();
+
+        // the space may be already reserved: the lock is taken in any case to settle it
+        mutex_lock(&tail_mutex[current_minor]);
+        acquired = now_ns();
+        lat_record(&stats->write_lock_wait, acquired - woken);
+        lat_record(&stats->write_blocked, woken - start);
+
+        if (res != 0) {
+            printk(KERN_ERR "%s: ERROR - process %d has been woken up by a signal\n", MODNAME, current->pid);
+            if (me.granted)
+                release_space(current_minor, me.need, me.need_mem);
+            else {
+                me.prev->next = me.next;
+                me.next->prev = me.prev;
+            }
+            grant_writers(current_minor);
+            publish_status(current_minor);
+            unlock_and_record(&tail_mutex[current_minor], &stats->write_lock_hold, acquired);
+            return -ERESTARTSYS;
+        }
+
+        printk(KERN_INFO "%s: process %d has been woken up\n", MODNAME, current->pid);
+        mem = me.need_mem;
+    }
+
+    // the first segment of an empty mailslot is linked with the head lock held as well
+    head_locked = lock_head_if_empty(current_minor);
+
+    // give back the chunk memory if the message fits in the open one after all
+    cost = memory_cost(current_minor, new_msg);
+    if (mem > cost) {
+        release_space(current_minor, 0, mem - cost);
+        mem = cost;
+        grant_writers(current_minor);
+    }
+
+    new_msg->meta.enqueue_time = now_ns();
+    new_msg->meta.seq = enqueued[current_minor];
+    track_arrival(current_minor, new_msg->meta.enqueue_time);
+
+    // add the message to the mailslot (used space has been already reserved)
+    added = 1;
+    if (batch != NULL)
+        added = pack_batch(current_minor, batch, mem);
+
+    else if (!is_packable(new_msg))
+        append_segment(current_minor, new_msg);
+
+    else if (pack_message(current_minor, new_msg) < 0) {
+        release_space(current_minor, new_msg->size, mem);
+        added = 0;
+    }
+
+    if (added == 0) {
+        printk(KERN_ERR "%s: ERROR - allocation of a chunk failed\n", MODNAME);
+        grant_writers(current_minor);
+        publish_status(current_minor);
+        if (head_locked)
+            mutex_unlock(&mutex[current_minor]);
+        unlock_and_record(&tail_mutex[current_minor], &stats->write_lock_hold, acquired);
+        return -ENOMEM;
+    }
+    count = atomic_add_return(added, &msg_count[current_minor]);
+    if (batch == NULL)
+        ACCESS_ONCE(enqueued[current_minor]) = enqueued[current_minor] + 1;
+    publish_status(current_minor);
+    notify_enqueue(current_minor, count, added);
+
+    // time to awake one reader
+    aux = &(readers_list[current_minor].head);
+    if (aux == NULL) {
+        printk(KERN_ERR "%s: ERROR - malformed readers sleeplist, service damaged!\n", MODNAME);
+        if (head_locked)
+            mutex_unlock(&mutex[current_minor]);
+        unlock_and_record(&tail_mutex[current_minor], &stats->write_lock_hold, acquired);
+        return -1;
+    }
+
+    if (head_locked) {
+        wake_readers(current_minor, batch, key);
+        mutex_unlock(&mutex[current_minor]);
+        unlock_and_record(&tail_mutex[current_minor], &stats->write_lock_hold, acquired);
+    }
+    else {
+        unlock_and_record(&tail_mutex[current_minor], &stats->write_lock_hold, acquired);
+        wake_reader_from_tail(current_minor, batch, key);
+    }
+
+    // a batch cut short keeps the records packed so far
+    if (batch != NULL && added < batch->records)
+        return -ENOMEM;
+    return len;
+}
+
+//----------------------------------------------------------------------
+
+// Links a chain of segments whose space has already been reserved, as done by mailslot_kenqueue_atomic().
+// They are neither compressed nor packed. Both locks are taken, to wake up the readers while linking.
+static void enqueue_reserved(int minor, segment* first) {
+    segment* msg;
+    unsigned int key;
+
+    mutex_lock(&mutex[minor]);
+    mutex_lock(&tail_mutex[minor]);
+
+    // time to awake one reader per linked segment
+    while (first != NULL) {
+        msg = first;
+        first = first->next;
+        key = msg->meta.key;
+        msg->meta.seq = enqueued[minor];
+        ACCESS_ONCE(enqueued[minor]) = enqueued[minor] + 1;
+        track_arrival(minor, msg->meta.enqueue_time);
+        append_segment(minor, msg);
+
+        wake_reader(minor, key);
+        notify_enqueue(minor, atomic_inc_return(&msg_count[minor]), 1);
+    }
+    publish_status(minor);
+
+    mutex_unlock(&tail_mutex[minor]);
+    mutex_unlock(&mutex[minor]);
+}
+
+//----------------------------------------------------------------------
+// Request/reply calls. The caller registers on the reply minor before its request is enqueued, so that the
+// reply can never arrive too early; the reply does not go through the mailslot, deliver_reply() hands it
+// over to the one caller waiting for its correlation id.
+
+// adds a caller waiting for up to capacity bytes of reply and assigns the correlation id of the call
+static void register_call(int minor, call_waiter* waiter, int capacity) {
+    waiter->task = current;
+    waiter->capacity = capacity;
+    waiter->reply = NULL;
+    waiter->granted = 0;
+
+    mutex_lock(&mutex[minor]);
+    waiter->call_id = ++call_ids[minor];
+    waiter->next = call_waiters[minor];
+    call_waiters[minor] = waiter;
+    mutex_unlock(&mutex[minor]);
+}
+
+// removes a caller that is not going to wait for its reply, freeing the reply if it already arrived
+static void cancel_call(int minor, call_waiter* waiter) {
+    call_waiter** aux;
+
+    mutex_lock(&mutex[minor]);
+    for (aux = &call_waiters[minor]; *aux != NULL; aux = &(*aux)->next) {
+        if (*aux == waiter) {
+            *aux = waiter->next;
+            break;
+        }
+    }
+    mutex_unlock(&mutex[minor]);
+
+    if (waiter->reply != NULL)
+        free_segment(waiter->reply);
+}
+
+// Sleeps until the reply of the call is handed over and returns its size; the caller owns waiter->reply.
+// The request has already been enqueued, so a signal gives -EINTR: restarting the call would send it again.
+static ssize_t wait_reply(int minor, call_waiter* waiter) {
+    if (wait_event_interruptible(callers_queue, ACCESS_ONCE(waiter->granted))) {
+        printk(KERN_ERR "%s: ERROR - process %d has been woken up by a signal\n", MODNAME, current->pid);
+        cancel_call(minor, waiter);
+        return -EINTR;
+    }
+    smp_rmb();
+
+    return waiter->reply->orig_size;
+}
+
+// Hands reply over to the caller waiting for call_id on the minor and wakes it up. Returns -ENOENT if nobody
+// is waiting (unknown id, or the caller gave up) and -EMSGSIZE if the reply does not fit in the caller buffer;
+// in both cases reply stays to the responder.
+static int deliver_reply(int minor, unsigned long long call_id, segment* reply) {
+    call_waiter** aux;
+    call_waiter* waiter;
+    struct task_struct* task;
+
+    mutex_lock(&mutex[minor]);
+    for (aux = &call_waiters[minor]; *aux != NULL && (*aux)->call_id != call_id; aux = &(*aux)->next)
+        ;
+    waiter = *aux;
+
+    if (waiter == NULL || reply->orig_size > waiter->capacity) {
+        mutex_unlock(&mutex[minor]);
+        return waiter == NULL ? -ENOENT : -EMSGSIZE;
+    }
+
+    // the waiter is on the stack of the caller, that may return (and exit) as soon as granted is set: the
+    // task is pinned until it has been woken up
+    *aux = waiter->next;
+    task = waiter->task;
+    get_task_struct(task);
+    waiter->reply = reply;
+    smp_wmb();
+    waiter->granted = 1;
+    wake_up_process(task);
+    mutex_unlock(&mutex[minor]);
+    put_task_struct(task);
+
+    return 0;
+}
+
+//----------------------------------------------------------------------
+
+static void init_mailslot(int minor) {
+    mailslots[minor] = NULL;
+    mailslots_tail[minor] = NULL;
+    memset(open_chunk[minor], 0, sizeof(open_chunk[minor]));
+    memset(&pools[minor], 0, sizeof(segment_pool));
+    spin_lock_init(&pools[minor].lock);
+    atomic_set(&used_space[minor], 0);
+    atomic_set(&used_memory[minor], 0);
+    atomic_set(&msg_count[minor], 0);
+    enqueued[minor] = 0;
+    dequeued[minor] = 0;
+    expired[minor] = 0;
+    ttl[minor] = 0;
+    busy_poll[minor] = 0;
+    last_arrival[minor] = 0;
+    arrival_ewma[minor] = 0;
+    partition_mode[minor] = 0;
+    partition_readers[minor] = NULL;
+    cache_wakeup[minor] = 0;
+    memset(partition_owner[minor], 0, sizeof(partition_owner[minor]));
+    call_waiters[minor] = NULL;
+    call_ids[minor] = 0;
+    status_page[minor] = NULL;
+    notify_ctx[minor] = NULL;
+    memset(&latency[minor], 0, sizeof(latency_stats));
+    mutex_init(&mutex[minor]);
+    mutex_init(&tail_mutex[minor]);
+    spin_lock_init(&status_lock[minor]);
+    readers_list[minor].head = head;
+    readers_list[minor].tail = tail;
+    readers_list[minor].head.next = &readers_list[minor].tail;
+    readers_list[minor].tail.prev = &readers_list[minor].head;
+    writers_list[minor].head = head;
+    writers_list[minor].tail = tail;
+    writers_list[minor].head.next = &writers_list[minor].tail;
+    writers_list[minor].tail.prev = &writers_list[minor].head;
+}
+
+// Frees every message still in the mailslot, no task must be using it. The pool is left alone: a multicast
+// payload goes back to the pool of its sender, so pools are trimmed once every mailslot has been cleaned up.
+static void cleanup_mailslot(int minor) {
+    segment* msg_to_delete;
+
+    while(mailslots[minor] != NULL) {
+        msg_to_delete = mailslots[minor];
+        mailslots[minor] = mailslots[minor]->next;
+        free_segment(msg_to_delete);
+    }
+    mailslots_tail[minor] = NULL;
+    memset(open_chunk[minor], 0, sizeof(open_chunk[minor]));
+
+    if (status_page[minor] != NULL)
+        free_page((unsigned long)status_page[minor]);
+    status_page[minor] = NULL;
+}
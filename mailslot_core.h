@@ -0,0 +1,162 @@
+#ifndef MAILSLOT_CORE_HEADER
+#define MAILSLOT_CORE_HEADER
+
+#define MODNAME "MAIL_SLOT"
+
+#define MAX_MAIL_SLOT_SIZE (1<<20) // 1MB of max storage (upper limit)
+#define MAX_SEGMENT_SIZE (1<<10) // 1KB of max segment size in a contiguous buffer, default limit
+#define MAX_MESSAGE_SIZE MAX_MAIL_SLOT_SIZE // upper limit, larger segments are stored in a vector of pages
+#define MAX_MINOR_NUM (256)
+#define MAX_MAIL_SLOT_MEMORY (2*MAX_MAIL_SLOT_SIZE) // real memory a mailslot can pin: segments, allocations and chunks
+#define PACKED_MAX_SIZE (256) // messages up to this size are packed in page-sized chunks
+#define CORK_BUFFER_SIZE PAGE_SIZE // staging buffer of a corked file, committed at once when full
+#define POOL_MAX 256 // freed segments, and pages, kept by each minor for its next messages
+
+#define BLOCKING_MODE 0
+#define NON_BLOCKING_MODE 1
+
+// eventfd notification events
+#define NOTIFY_NON_EMPTY 0x1    // mailslot goes from empty to non-empty
+#define NOTIFY_DEPTH 0x2        // number of messages reaches the configured depth
+#define NOTIFY_SPACE 0x4        // a message has been removed, freeing space
+
+// partitioned consumption, see CHANGE_PARTITION_MODE_CTL
+#define NUM_PARTITIONS 32
+#define PARTITION(seg) ((seg)->meta.key % NUM_PARTITIONS)
+
+// cache-aware wakeup of readers, see wake_reader() and CHANGE_WAKEUP_POLICY_CTL
+#define WAKEUP_SCAN 8           // sleeping readers looked at for the closest one
+#define WAKEUP_MAX_SKIPS 4      // a reader passed over this many times is woken up anyway
+
+// latency histograms: bucket i counts samples in [2^(i-1), 2^i) ns, last bucket also takes everything above
+#define LAT_HIST_BUCKETS 32
+
+// per-message metadata, kept in the segment or in the record of a packed message
+typedef struct msg_meta{
+    unsigned long long enqueue_time;    // ns, monotonic
+    unsigned long long seq;             // per-minor sequence number, assigned in arrival order from 0
+    unsigned int key;                   // partition key, 0 unless set by the writer in partition mode
+    unsigned long long call_id;         // correlation id of a CALL_CTL request, 0 for plain messages
+} msg_meta;
+
+typedef struct segment{
+    int size;               // stored bytes, accounted in used_space
+    int orig_size;          // message size, differs from size only if compressed
+    int compressed;
+    int packed;             // page-sized chunk of records instead of a single message
+    int batch;              // records staged by a corked writer, never linked (see stage_record())
+    int records;            // batch only, number of records
+    int read_offset;        // chunk only, first record not read yet
+    int write_offset;       // chunk and batch, end of the last record
+    char* payload;
+    char** pages;           // large segments only (above MAX_SEGMENT_SIZE): payload split in order-0 pages
+    int nr_pages;
+    struct segment* shared; // multicast only: owner of payload and pages, see share_segment()
+    atomic_t refs;          // owner of a shared payload: segments using it, plus one for the multicaster
+    struct segment_pool* pool;  // where the segment and its pages go back when freed, NULL to the allocator
+    msg_meta meta;
+    struct segment* next;
+    struct llist_node lnode;            // pending list of mailslot_kenqueue_atomic()
+} segment;
+
+// Segments and order-0 pages (chunks and large messages) freed on a minor, kept for its next messages so that a
+// mailslot draining and filling up again does not go through the allocator every time. Trimmed by the
+// shrinker of the module under memory pressure, see pool_trim().
+typedef struct segment_pool{
+    spinlock_t lock;
+    segment* segments;          // linked through next
+    char* pages;                // linked through the first word of each page
+    int nr_segments;
+    int nr_pages;
+    unsigned long long hits;    // segments and pages taken from the pool
+    unsigned long long misses;  // taken from the allocator, the pool being empty
+    unsigned long long trimmed; // given back to the allocator by pool_trim()
+} segment_pool;
+
+// header of a message packed in a chunk, followed by its payload
+typedef struct record{
+    int size;
+    msg_meta meta;
+} record;
+
+#define RECORD_SPACE(size) ALIGN(sizeof(record) + (size), sizeof(long))
+#define CHUNK_MEMORY (sizeof(segment) + PAGE_SIZE)
+
+// a message removed from the mailslot, owned by the reader
+typedef struct message{
+    int size;
+    msg_meta meta;
+    unsigned long long dequeue_time;        // ns, monotonic
+    segment* seg;                           // detached segment, NULL if the message was packed
+    char packed_payload[PACKED_MAX_SIZE];   // copy of a packed message, taken in critical section
+} message;
+
+// Read-only page mapped by mmap() on the device file, one per minor. Values are published under a sequence
+// counter: it is odd while an update is in progress, readers retry until they see the same even value
+// before and after loading the fields.
+typedef struct mailslot_status{
+    unsigned int seq;
+    int used_space;
+    int used_memory;
+    int msg_count;
+    int max_size;                   // MAX_MAIL_SLOT_SIZE
+    int max_memory;                 // MAX_MAIL_SLOT_MEMORY
+    int max_segment_size;           // current limit, see CHANGE_MAX_SEGMENT_SIZE_CTL
+    unsigned long long enqueued;    // messages added since the module was loaded
+    unsigned long long dequeued;    // messages removed
+    unsigned long long expired;     // messages dropped because older than the TTL
+} mailslot_status;
+
+// A reader file registered on a minor. In partition mode partition p is taken only by the reader that owns it,
+// so messages with the same key are consumed in order even with several readers.
+typedef struct partition_reader{
+    struct partition_reader* next;      // registered readers of the minor, in open order
+    int cpu_hint;                       // CPU the reader runs on, -1 if unknown (see SET_READER_CPU_CTL)
+} partition_reader;
+
+typedef struct _elem{
+    struct task_struct *task;
+    int pid;
+    struct _elem * next;
+    struct _elem * prev;
+    int need;       // writers only: space and memory waited for, see grant_writers()
+    int need_mem;
+    int granted;    // set, and the task unlinked, by whoever wakes it up
+    partition_reader* reader;   // readers only, NULL takes any message
+    int cpu;        // readers only: CPU the task sleeps on, or its hint
+    int skipped;    // readers only: wakeups given to a closer reader behind it
+} elem;
+
+// A caller of CALL_CTL waiting for its reply, registered on the reply minor. The responder hands the reply
+// over with deliver_reply(), which unlinks the waiter and sets granted.
+typedef struct call_waiter{
+    struct task_struct *task;
+    unsigned long long call_id;
+    int capacity;                   // size of the reply buffer of the caller
+    segment* reply;
+    int granted;
+    struct call_waiter* next;
+} call_waiter;
+
+typedef struct list{
+   elem head;
+   elem tail;
+}list;
+
+typedef struct lat_hist{
+    unsigned long long bucket[LAT_HIST_BUCKETS];
+} lat_hist;
+
+// per-minor, returned to user space by GET_LATENCY_STATS_CTL
+typedef struct latency_stats{
+    lat_hist read_lock_wait;
+    lat_hist read_lock_hold;
+    lat_hist write_lock_wait;
+    lat_hist write_lock_hold;
+    lat_hist read_blocked;      // time spent in wait_event_interruptible
+    lat_hist write_blocked;
+    lat_hist residency;         // enqueue to dequeue
+} latency_stats;
+
+
+#endif
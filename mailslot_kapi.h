@@ -0,0 +1,21 @@
+#ifndef MAILSLOT_KAPI_HEADER
+#define MAILSLOT_KAPI_HEADER
+
+/*
+ * In-kernel API of the mailslot driver, for modules that produce or consume messages
+ * without going through /dev/mailslotN. Messages share queues, space accounting and
+ * wakeups with read() and write() on the same minor.
+ */
+
+#include <linux/types.h>
+
+#define MAILSLOT_KNONBLOCK 0x1  // fail with -EAGAIN instead of sleeping
+
+// process context only, may sleep unless MAILSLOT_KNONBLOCK is given
+extern ssize_t mailslot_kenqueue(int minor, const void *buf, size_t len, int flags);
+extern ssize_t mailslot_kdequeue(int minor, void *buf, size_t len, int flags);
+
+// safe in atomic context (spinlocks held, irq handlers): never sleeps, -EAGAIN if the mailslot is full
+extern ssize_t mailslot_kenqueue_atomic(int minor, const void *buf, size_t len);
+
+#endif